@@ -0,0 +1,111 @@
+//
+// Created by lukas on 19.10.26.
+//
+
+#include "Epoch.h"
+
+#include <algorithm>
+
+// Number of pending retirements after which retire() tries to reclaim
+constexpr size_t RECLAIM_THRESHOLD = 64;
+
+EpochManager::EpochManager() : globalEpoch(0) {
+
+}
+
+EpochManager::~EpochManager() {
+    for (auto& r : retired) {
+        r.second();
+    }
+}
+
+EpochParticipant* EpochManager::registerThread() {
+    std::lock_guard lock(participantsMutex);
+
+    participants.emplace_back(std::make_unique<EpochParticipant>());
+    return participants.back().get();
+}
+
+void EpochManager::unregisterThread(EpochParticipant* participant) {
+    {
+        std::lock_guard lock(participantsMutex);
+
+        auto it = std::find_if(participants.begin(), participants.end(), [=](const auto& p) {
+            return p.get() == participant;
+        });
+
+        if (it != participants.end()) {
+            participants.erase(it);
+        }
+    }
+
+    reclaim();
+}
+
+void EpochManager::enter(EpochParticipant* participant) {
+    if (participant->nesting++ == 0) {
+        participant->localEpoch.store(globalEpoch.load());
+    }
+}
+
+void EpochManager::exit(EpochParticipant* participant) {
+    if (--participant->nesting == 0) {
+        participant->localEpoch.store(QUIESCENT_EPOCH);
+    }
+}
+
+uint64_t EpochManager::retireEpoch() {
+    return globalEpoch.fetch_add(1);
+}
+
+uint64_t EpochManager::safeEpoch() {
+    uint64_t safe = globalEpoch.load();
+
+    std::lock_guard lock(participantsMutex);
+    for (const auto& p : participants) {
+        safe = std::min(safe, p->localEpoch.load());
+    }
+
+    return safe;
+}
+
+void EpochManager::retire(std::function<void()> deleter) {
+    size_t pending = 0;
+    {
+        std::lock_guard lock(retiredMutex);
+        retired.emplace_back(retireEpoch(), std::move(deleter));
+        pending = retired.size();
+    }
+
+    if (pending >= RECLAIM_THRESHOLD) {
+        reclaim();
+    }
+}
+
+void EpochManager::reclaim() {
+    auto safe = safeEpoch();
+
+    std::vector<std::function<void()>> deleters;
+    {
+        std::lock_guard lock(retiredMutex);
+
+        auto end = std::stable_partition(retired.begin(), retired.end(), [=](const auto& r) {
+            return r.first < safe;
+        });
+
+        for (auto it = retired.begin(); it != end; it++) {
+            deleters.emplace_back(std::move(it->second));
+        }
+        retired.erase(retired.begin(), end);
+    }
+
+    // Deleters run without holding any lock, they may retire further memory
+    for (auto& d : deleters) {
+        d();
+    }
+}
+
+size_t EpochManager::pendingRetirements() {
+    std::lock_guard lock(retiredMutex);
+    return retired.size();
+}
@@ -0,0 +1,123 @@
+//
+// Created by lukas on 19.10.26.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/*
+ * Epoch based reclamation.
+ *
+ * Every thread that reads shared structures registers an EpochParticipant
+ * (one per IdxState) and announces the global epoch while it is inside an
+ * operation. Memory that got unlinked is retired with the epoch of its
+ * unlinking and may only be reused or freed once no participant announces
+ * an epoch that is older than or equal to that one.
+ */
+
+constexpr uint64_t QUIESCENT_EPOCH = UINT64_MAX;
+
+struct EpochParticipant {
+    std::atomic<uint64_t> localEpoch {QUIESCENT_EPOCH};
+    uint32_t nesting = 0;
+};
+
+class EpochManager {
+public:
+    EpochManager();
+    ~EpochManager();
+
+    EpochParticipant* registerThread();
+    void unregisterThread(EpochParticipant* participant);
+
+    void enter(EpochParticipant* participant);
+    void exit(EpochParticipant* participant);
+
+    // Closes the current epoch, everything unlinked before this call is tagged with the returned epoch
+    uint64_t retireEpoch();
+
+    // Everything retired with an epoch smaller than this can not be referenced anymore
+    uint64_t safeEpoch();
+
+    void retire(std::function<void()> deleter);
+    void reclaim();
+
+    size_t pendingRetirements();
+
+private:
+    std::atomic<uint64_t> globalEpoch;
+
+    std::mutex participantsMutex;
+    std::vector<std::unique_ptr<EpochParticipant>> participants;
+
+    std::mutex retiredMutex;
+    std::vector<std::pair<uint64_t, std::function<void()>>> retired;
+};
+
+class EpochGuard {
+public:
+    EpochGuard(EpochManager& manager, EpochParticipant* participant) : manager(manager), participant(participant) {
+        manager.enter(participant);
+    }
+
+    ~EpochGuard() {
+        manager.exit(participant);
+    }
+
+    EpochGuard(const EpochGuard&) = delete;
+    EpochGuard& operator=(const EpochGuard&) = delete;
+
+private:
+    EpochManager& manager;
+    EpochParticipant* participant;
+};
+
+/*
+ * Retired slots of an arena (e.g. trie node offsets), ordered by their retire epoch.
+ */
+template<typename T>
+class RetireList {
+public:
+    void retire(T item, uint64_t epoch) {
+        items.emplace_back(epoch, std::move(item));
+    }
+
+    template<typename F>
+    void collect(uint64_t safeEpoch, F f) {
+        size_t i = 0;
+        for (; i < items.size() && items[i].first < safeEpoch; i++) {
+            f(items[i].second);
+        }
+
+        items.erase(items.begin(), items.begin() + i);
+    }
+
+    template<typename F>
+    void forEach(F f) const {
+        for (const auto& item : items) {
+            f(item.second);
+        }
+    }
+
+    void clear() {
+        items.clear();
+    }
+
+    bool empty() const {
+        return items.empty();
+    }
+
+    size_t size() const {
+        return items.size();
+    }
+
+private:
+    std::vector<std::pair<uint64_t, T>> items;
+};
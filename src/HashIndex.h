@@ -0,0 +1,107 @@
+//
+// Created by lukas on 19.10.26.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "types.h"
+
+/*
+ * Open addressing hash table from encoded keys to L1 offsets, with linear
+ * probing. Only the hashes and the offsets are stored, the keys are read
+ * from the L1 items when a probe hits a matching hash.
+ */
+class HashIndex {
+public:
+    template<typename KeyMatches>
+    offset find(uint32_t hash, KeyMatches keyMatches) const {
+        if (slots.empty()) {
+            return NO_CHILD;
+        }
+
+        for (size_t i = hash & mask(); slots[i].l1Offset != NO_CHILD; i = (i + 1) & mask()) {
+            if (slots[i].hash == hash && keyMatches(slots[i].l1Offset)) {
+                return slots[i].l1Offset;
+            }
+        }
+        return NO_CHILD;
+    }
+
+    void insert(uint32_t hash, offset l1Offset) {
+        // At most half full, so probe sequences stay short
+        if ((count + 1) * 2 > slots.size()) {
+            grow();
+        }
+
+        size_t i = hash & mask();
+        while (slots[i].l1Offset != NO_CHILD) {
+            i = (i + 1) & mask();
+        }
+        slots[i] = Slot {hash, l1Offset};
+        count++;
+    }
+
+    void erase(uint32_t hash, offset l1Offset) {
+        if (slots.empty()) {
+            return;
+        }
+
+        size_t i = hash & mask();
+        while (slots[i].l1Offset != l1Offset) {
+            if (slots[i].l1Offset == NO_CHILD) {
+                return;
+            }
+            i = (i + 1) & mask();
+        }
+
+        // Shift the following entries of the cluster back instead of leaving a tombstone
+        size_t hole = i;
+        for (size_t j = (i + 1) & mask(); slots[j].l1Offset != NO_CHILD; j = (j + 1) & mask()) {
+            size_t home = slots[j].hash & mask();
+            bool movable = hole <= j ? (home <= hole || home > j) : (home <= hole && home > j);
+            if (movable) {
+                slots[hole] = slots[j];
+                hole = j;
+            }
+        }
+        slots[hole] = Slot {};
+        count--;
+    }
+
+    void clear() {
+        slots.clear();
+        count = 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+private:
+    struct Slot {
+        uint32_t hash = 0;
+        offset l1Offset = NO_CHILD;
+    };
+
+    size_t mask() const {
+        return slots.size() - 1;
+    }
+
+    void grow() {
+        std::vector<Slot> old(std::max<size_t>(slots.size() * 2, 64));
+        old.swap(slots);
+        count = 0;
+        for (const auto& slot : old) {
+            if (slot.l1Offset != NO_CHILD) {
+                insert(slot.hash, slot.l1Offset);
+            }
+        }
+    }
+
+    std::vector<Slot> slots;
+    size_t count = 0;
+};
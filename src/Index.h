@@ -0,0 +1,261 @@
+//
+// Created by lukas on 19.10.26.
+//
+
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include "MemDB.h"
+#include "bitutils.h"
+
+/*
+ * Typed C++ API.
+ *
+ * Index<K> and Transaction call the trees directly instead of going through
+ * the C functions of server.h: keys are encoded straight from their C++ type
+ * without being widened into a Key, the key type is checked once when the
+ * index is opened, and transactions live on the stack.
+ *
+ * Supported key types are int32_t (SHORT), int64_t (INT) and
+ * std::string_view (VARCHAR, without null characters). Payloads are
+ * null-terminated strings of at most MAX_PAYLOAD_LEN characters, like in the
+ * C API. Calls with a key the C API could not represent, a string with null
+ * characters or longer than MAX_VARCHAR_LEN, fail with FAILURE.
+ */
+
+template<typename K>
+struct KeyTraits;
+
+template<>
+struct KeyTraits<int32_t> {
+    static constexpr KeyType type = SHORT;
+    // Key of the records returned by getNext
+    using Value = int32_t;
+
+    static bool encode(int32_t key, bool, uint8_t* keyData) {
+        int32ToByteArray(keyData, key);
+        return true;
+    }
+
+    static int32_t decode(const uint8_t* keyData, bool) {
+        return charArrayToInt32(keyData);
+    }
+};
+
+template<>
+struct KeyTraits<int64_t> {
+    static constexpr KeyType type = INT;
+    using Value = int64_t;
+
+    static bool encode(int64_t key, bool, uint8_t* keyData) {
+        int64ToByteArray(keyData, key);
+        return true;
+    }
+
+    static int64_t decode(const uint8_t* keyData, bool) {
+        return charArrayToInt64(keyData);
+    }
+};
+
+template<>
+struct KeyTraits<std::string_view> {
+    static constexpr KeyType type = VARCHAR;
+    using Value = std::string;
+
+    // Truncating or cutting off at a null character would let distinct keys share one entry
+    static bool encode(std::string_view key, bool leftAligned, uint8_t* keyData) {
+        if (key.size() > MAX_VARCHAR_LEN || key.find('\0') != std::string_view::npos) {
+            return false;
+        }
+
+        memcpy(leftAligned ? keyData : keyData + MAX_VARCHAR_LEN - key.size(), key.data(), key.size());
+        return true;
+    }
+
+    static std::string decode(const uint8_t* keyData, bool leftAligned) {
+        if (leftAligned) {
+            return std::string((const char*) keyData, strnlen((const char*) keyData, MAX_VARCHAR_LEN));
+        }
+
+        size_t offset = varcharPaddingLength(keyData);
+        return std::string((const char*) keyData + offset, MAX_VARCHAR_LEN - offset);
+    }
+};
+
+// A transaction on the stack, aborted when it goes out of scope without a commit
+class Transaction {
+public:
+    explicit Transaction(MemDB& db) : db(db), state(db.getTransactionID()), active(true) {
+
+    }
+
+    ~Transaction() {
+        abort();
+    }
+
+    Transaction(const Transaction&) = delete;
+    Transaction& operator=(const Transaction&) = delete;
+
+    void commit() {
+        if (active) {
+            db.commitTransactionState(state);
+            active = false;
+        }
+    }
+
+    void abort() {
+        if (active) {
+            db.abortTransactionState(state);
+            active = false;
+        }
+    }
+
+    TxnState* txnState() {
+        return active ? &state : nullptr;
+    }
+
+private:
+    MemDB& db;
+    TxnState state;
+    bool active;
+};
+
+template<typename K>
+class Index {
+public:
+    using Value = typename KeyTraits<K>::Value;
+
+    struct Entry {
+        Value key;
+        char payload[MAX_PAYLOAD_LEN + 1];
+    };
+
+    Index() : db(nullptr), state(nullptr), leftAligned(false) {
+
+    }
+
+    ~Index() {
+        close();
+    }
+
+    Index(const Index&) = delete;
+    Index& operator=(const Index&) = delete;
+
+    Index(Index&& other) noexcept : db(other.db), state(std::exchange(other.state, nullptr)), leftAligned(other.leftAligned) {
+
+    }
+
+    Index& operator=(Index&& other) noexcept {
+        if (this != &other) {
+            close();
+            db = other.db;
+            state = std::exchange(other.state, nullptr);
+            leftAligned = other.leftAligned;
+        }
+        return *this;
+    }
+
+    /**
+     Opens the index with the given name for the calling thread.
+     @return DB_DNE if there is no such index, FAILURE if its key type is not K
+     */
+    ErrCode open(MemDB& memDb, const char* name) {
+        IdxState* idxState = nullptr;
+        auto result = memDb.openIndex(name, &idxState);
+        if (result != SUCCESS) {
+            return result;
+        }
+
+        if (idxState->tree->keyType != KeyTraits<K>::type) {
+            memDb.closeIndex(idxState);
+            return FAILURE;
+        }
+
+        close();
+        db = &memDb;
+        state = idxState;
+        leftAligned = KeyTraits<K>::type == VARCHAR && state->tree->indexOptions().leftAlignedVarchar;
+        return SUCCESS;
+    }
+
+    void close() {
+        if (state) {
+            db->closeIndex(state);
+            state = nullptr;
+        }
+    }
+
+    // The calls have the same results as their counterparts in server.h, a null transaction commits immediately
+
+    ErrCode get(Transaction* txn, K key, char* payload) {
+        std::array<uint8_t, max_size()> keyData {};
+        if (!encode(key, keyData)) {
+            return FAILURE;
+        }
+
+        EpochGuard guard(db->getEpochManager(), state->epoch);
+        return state->tree->getEncoded(txnState(txn), keyData, payload, &state->finger);
+    }
+
+    ErrCode getNext(Transaction* txn, Entry* entry) {
+        EpochGuard guard(db->getEpochManager(), state->epoch);
+        std::array<uint8_t, max_size()> keyData {};
+        auto result = state->tree->getNextEncoded(txnState(txn), keyData, entry->payload);
+        if (result == SUCCESS) {
+            entry->key = KeyTraits<K>::decode(keyData.data(), leftAligned);
+        }
+        return result;
+    }
+
+    ErrCode insert(Transaction* txn, K key, const char* payload) {
+        std::array<uint8_t, max_size()> keyData {};
+        if (!encode(key, keyData)) {
+            return FAILURE;
+        }
+
+        EpochGuard guard(db->getEpochManager(), state->epoch);
+        return state->tree->insertEncoded(txnState(txn), keyData, payload);
+    }
+
+    ErrCode update(Transaction* txn, K key, const char* oldPayload, const char* newPayload) {
+        std::array<uint8_t, max_size()> keyData {};
+        if (!encode(key, keyData)) {
+            return FAILURE;
+        }
+
+        EpochGuard guard(db->getEpochManager(), state->epoch);
+        return state->tree->updateEncoded(txnState(txn), keyData, oldPayload, newPayload);
+    }
+
+    // Deletes the key/payload pair, or all records of the key if payload is null
+    ErrCode remove(Transaction* txn, K key, const char* payload = nullptr) {
+        std::array<uint8_t, max_size()> keyData {};
+        if (!encode(key, keyData)) {
+            return FAILURE;
+        }
+
+        EpochGuard guard(db->getEpochManager(), state->epoch);
+        return state->tree->deleteEncoded(txnState(txn), keyData, payload);
+    }
+
+    IdxState* idxState() {
+        return state;
+    }
+
+private:
+    MemDB* db;
+    IdxState* state;
+    bool leftAligned;
+
+    bool encode(K key, std::array<uint8_t, max_size()>& keyData) const {
+        return KeyTraits<K>::encode(key, leftAligned, keyData.data());
+    }
+
+    static TxnState* txnState(Transaction* txn) {
+        return txn ? txn->txnState() : nullptr;
+    }
+};
@@ -0,0 +1,99 @@
+//
+// Created by lukas on 19.10.26.
+//
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+/*
+ * Blocked counting Bloom filter over key hashes.
+ *
+ * Every key sets KEY_FILTER_PROBES 4 bit counters within a single 64 byte
+ * block, so a lookup touches one cache line. The counters make removal
+ * possible, a counter that saturated stays at its maximum and may only
+ * cause false positives. The filter is sized for a number of keys, the
+ * owner rebuilds it with a larger capacity once it is exceeded.
+ */
+constexpr uint32_t KEY_FILTER_PROBES = 4;
+// Counters per key, the false positive rate is below 1% at full capacity
+constexpr size_t KEY_FILTER_COUNTERS_PER_KEY = 16;
+
+class KeyFilter {
+public:
+    void reset(size_t keys) {
+        size_t blocks = 1;
+        while (blocks * COUNTERS_PER_BLOCK < keys * KEY_FILTER_COUNTERS_PER_KEY) {
+            blocks *= 2;
+        }
+
+        this->blocks.assign(blocks, Block {});
+        this->keys = 0;
+        this->keyCapacity = keys;
+    }
+
+    bool mayContain(uint64_t hash) const {
+        const Block& block = blocks[blockOf(hash)];
+        for (uint32_t i = 0; i < KEY_FILTER_PROBES; i++) {
+            if (counter(block, counterOf(hash, i)) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void add(uint64_t hash) {
+        Block& block = blocks[blockOf(hash)];
+        for (uint32_t i = 0; i < KEY_FILTER_PROBES; i++) {
+            auto c = counterOf(hash, i);
+            if (counter(block, c) < MAX_COUNT) {
+                block[c / 16] += 1ull << (c % 16 * 4);
+            }
+        }
+        keys++;
+    }
+
+    void remove(uint64_t hash) {
+        Block& block = blocks[blockOf(hash)];
+        for (uint32_t i = 0; i < KEY_FILTER_PROBES; i++) {
+            auto c = counterOf(hash, i);
+            if (counter(block, c) < MAX_COUNT) {
+                block[c / 16] -= 1ull << (c % 16 * 4);
+            }
+        }
+        keys--;
+    }
+
+    bool full() const {
+        return keys >= keyCapacity;
+    }
+
+    size_t capacity() const {
+        return keyCapacity;
+    }
+
+private:
+    // 128 counters of 4 bits
+    using Block = std::array<uint64_t, 8>;
+    static constexpr uint32_t COUNTERS_PER_BLOCK = 128;
+    static constexpr uint64_t MAX_COUNT = 15;
+
+    size_t blockOf(uint64_t hash) const {
+        return (hash >> 32) & (blocks.size() - 1);
+    }
+
+    // Every probe takes 7 of the low 32 bits
+    static uint32_t counterOf(uint64_t hash, uint32_t probe) {
+        return (hash >> (probe * 7)) & (COUNTERS_PER_BLOCK - 1);
+    }
+
+    static uint64_t counter(const Block& block, uint32_t c) {
+        return (block[c / 16] >> (c % 16 * 4)) & MAX_COUNT;
+    }
+
+    std::vector<Block> blocks;
+    size_t keys = 0;
+    size_t keyCapacity = 0;
+};
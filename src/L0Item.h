@@ -10,7 +10,7 @@
 
 
 
-struct L0Item {
+struct alignas(64) L0Item {
     L0Item() : children() {
         children.fill(NO_CHILD);
     }
@@ -18,3 +18,27 @@ struct L0Item {
     std::array<offset, 16> children;
 };
 
+inline bool hasChildren(const L0Item& l0Item) {
+    for (auto child : l0Item.children) {
+        if (isNodePresent(child)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Returns the only child if it is an L1 node, NO_CHILD otherwise
+inline offset singleL1Child(const L0Item& l0Item) {
+    offset single = NO_CHILD;
+    for (auto child : l0Item.children) {
+        if (isNodePresent(child)) {
+            if (isNodePresent(single) || !isL1Node(child)) {
+                return NO_CHILD;
+            }
+            single = child;
+        }
+    }
+
+    return single;
+}
@@ -16,4 +16,9 @@ struct L2Item {
 
     char payload[MAX_PAYLOAD_LEN + 1];
     uint32_t timestamp;
+};
+
+struct RowIdItem {
+    uint64_t rowId;
+    uint32_t timestamp;
 };
\ No newline at end of file
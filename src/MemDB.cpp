@@ -18,12 +18,21 @@ MemDB::~MemDB() {
 }
 
 ErrCode MemDB::create(KeyType type, char *name) {
+    return createWithOptions(type, name, IndexOptions {});
+}
+
+ErrCode MemDB::createWithOptions(KeyType type, char *name, const IndexOptions& options) {
     std::lock_guard<std::shared_mutex> l(this->mtx);
 
     if (this->tries.count(name) != 0) {
         return DB_EXISTS;
     }
-    auto new_tree = new Tree(type, this);
+
+    // The hash index answers every point lookup, a hot key cache in front of it would never be consulted
+    if (options.hotKeyCacheSize > 0 && options.hashIndex) {
+        return FAILURE;
+    }
+    auto new_tree = new Tree(type, this, options);
     this->tries.insert(std::make_pair(name, new_tree));
 
     return SUCCESS;
@@ -40,7 +49,11 @@ ErrCode MemDB::drop(char *name) {
 
     auto trie = it->second;
     tries.erase(it);
-    delete trie;
+
+    // Operations that already resolved their IdxState may still be running on this tree
+    epochManager.retire([=]() {
+        delete trie;
+    });
     return SUCCESS;
 }
 
@@ -53,35 +66,175 @@ ErrCode MemDB::openIndex(const char *name, IdxState **idxState) {
 
     auto state = new IdxState;
     state->tree = it->second;
+    state->epoch = epochManager.registerThread();
     *idxState = state;
 
     return SUCCESS;
 }
 
 ErrCode MemDB::closeIndex(IdxState *idxState) {
+    epochManager.unregisterThread(idxState->epoch);
     delete idxState;
 
     return SUCCESS;
 }
 
 ErrCode MemDB::deleteRecord(IdxState *idxState, TxnState *txn, Record *record) {
+    EpochGuard guard(epochManager, idxState->epoch);
     auto tree = idxState->tree;
     return tree->deleteRecord(txn, record);
 }
 
 ErrCode MemDB::insertRecord(IdxState *idxState, TxnState *txn, Key *k, const char *payload) {
+    EpochGuard guard(epochManager, idxState->epoch);
     auto tree = idxState->tree;
     return tree->insertRecord(txn, k, payload);
 }
 
+ErrCode MemDB::updateRecord(IdxState *idxState, TxnState *txn, Key *k, const char *oldPayload, const char *newPayload) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->updateRecord(txn, k, oldPayload, newPayload);
+}
+
+ErrCode MemDB::upsertRecord(IdxState *idxState, TxnState *txn, Key *k, const char *oldPayload, const char *newPayload) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->upsertRecord(txn, k, oldPayload, newPayload);
+}
+
 ErrCode MemDB::getNext(IdxState *idxState, TxnState *txn, Record *record) {
+    EpochGuard guard(epochManager, idxState->epoch);
     auto tree = idxState->tree;
     return tree->getNext(txn, record);
 }
 
+ErrCode MemDB::getNextBatch(IdxState *idxState, TxnState *txn, Record *records, size_t count, size_t *produced) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->getNextBatch(txn, records, count, produced);
+}
+
+ErrCode MemDB::seekRange(IdxState *idxState, TxnState *txn, const KeyRange *range) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->seekRange(txn, range, false);
+}
+
+ErrCode MemDB::scanRange(IdxState *idxState, TxnState *txn, const KeyRange *range, Record *records, size_t count, size_t *produced) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->scanRange(txn, range, false, records, count, produced);
+}
+
+ErrCode MemDB::seekRangeDescending(IdxState *idxState, TxnState *txn, const KeyRange *range) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->seekRange(txn, range, true);
+}
+
+ErrCode MemDB::scanRangeDescending(IdxState *idxState, TxnState *txn, const KeyRange *range, Record *records, size_t count, size_t *produced) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->scanRange(txn, range, true, records, count, produced);
+}
+
+ErrCode MemDB::getPrev(IdxState *idxState, TxnState *txn, Record *record) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->getPrev(txn, record);
+}
+
+ErrCode MemDB::countRange(IdxState *idxState, const KeyRange *range, size_t *count) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->countRange(range, count);
+}
+
+ErrCode MemDB::rankOfKey(IdxState *idxState, const Key *key, size_t *rank) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->rankOfKey(key, rank);
+}
+
+ErrCode MemDB::selectKey(IdxState *idxState, size_t rank, Key *key) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->selectKey(rank, key);
+}
+
+ErrCode MemDB::prefixScan(IdxState *idxState, TxnState *txn, const char *prefix, Record *records, size_t count, size_t *produced) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->prefixScan(txn, prefix, records, count, produced);
+}
+
 ErrCode MemDB::get(IdxState *idxState, TxnState *txn, Record *record) {
+    EpochGuard guard(epochManager, idxState->epoch);
     auto tree = idxState->tree;
-    return tree->get(txn, record);
+    return tree->get(txn, record, &idxState->finger);
+}
+
+ErrCode MemDB::deleteRange(IdxState *idxState, const KeyRange *range, size_t *deleted) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->deleteRange(range, deleted);
+}
+
+ErrCode MemDB::truncateIndex(IdxState *idxState) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    tree->truncate();
+    return SUCCESS;
+}
+
+ErrCode MemDB::insertRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t rowId) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->insertRowId(txn, k, rowId);
+}
+
+ErrCode MemDB::getRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t *rowId) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->getRowId(txn, k, rowId);
+}
+
+ErrCode MemDB::getNextRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t *rowId) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->getNextRowId(txn, k, rowId);
+}
+
+ErrCode MemDB::deleteRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t rowId) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->deleteRowId(txn, k, rowId);
+}
+
+ErrCode MemDB::getIndexStatistics(IdxState *idxState, IndexStatistics *stats) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    *stats = tree->statistics();
+    return SUCCESS;
+}
+
+ErrCode MemDB::compactIndex(IdxState *idxState) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->compact() ? SUCCESS : FAILURE;
+}
+
+ErrCode MemDB::bulkLoad(IdxState *idxState, const Record *records, size_t count, unsigned threads) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->bulkLoad(records, count, threads);
+}
+
+ErrCode MemDB::getBatch(IdxState *idxState, TxnState *txn, Record *records, size_t count, ErrCode *results) {
+    EpochGuard guard(epochManager, idxState->epoch);
+    auto tree = idxState->tree;
+    return tree->getBatch(txn, records, count, results);
 }
 
 ErrCode MemDB::beginTransaction(TxnState **txn) {
@@ -91,25 +244,37 @@ ErrCode MemDB::beginTransaction(TxnState **txn) {
 }
 
 ErrCode MemDB::commitTransaction(TxnState *txn) {
-    std::shared_lock<std::shared_mutex> l(this->mtx);
-    for (auto& s : this->tries) {
-        s.second->commit(txn->transactionId);
-    }
+    commitTransactionState(*txn);
     delete txn;
 
     return SUCCESS;
 }
 
 ErrCode MemDB::abortTransaction(TxnState *txn) {
+    abortTransactionState(*txn);
+    delete txn;
+    return SUCCESS;
+}
+
+void MemDB::commitTransactionState(const TxnState& txn) {
+    std::shared_lock<std::shared_mutex> l(this->mtx);
+    for (auto& s : this->tries) {
+        s.second->commit(txn.transactionId);
+    }
+}
+
+void MemDB::abortTransactionState(const TxnState& txn) {
     std::shared_lock<std::shared_mutex> l(this->mtx);
 
     for (auto& s : this->tries) {
-        s.second->abort(txn->transactionId);
+        s.second->abort(txn.transactionId);
     }
-    delete txn;
-    return SUCCESS;
 }
 
 uint32_t MemDB::getTransactionID() {
     return __sync_fetch_and_add(&this->transactionIDCounter, 1);
-}
\ No newline at end of file
+}
+
+EpochManager& MemDB::getEpochManager() {
+    return epochManager;
+}
@@ -9,6 +9,8 @@
 #include <memory>
 #include <shared_mutex>
 #include "Tree.h"
+#include "Epoch.h"
+#include "ReadGuard.h"
 #include "server.h"
 
 class MemDB {
@@ -16,19 +18,47 @@ public:
     MemDB();
     ~MemDB();
     ErrCode create(KeyType type, char *name);
+    ErrCode createWithOptions(KeyType type, char *name, const IndexOptions& options);
     ErrCode drop(char *name);
     ErrCode openIndex(const char *name, IdxState **idxState);
     ErrCode closeIndex(IdxState *idxState);
     ErrCode beginTransaction(TxnState **txn);
     ErrCode abortTransaction(TxnState *txn);
     ErrCode commitTransaction(TxnState *txn);
+    // Ends a transaction whose TxnState was not allocated by beginTransaction, without freeing it
+    void commitTransactionState(const TxnState& txn);
+    void abortTransactionState(const TxnState& txn);
     ErrCode get(IdxState *idxState, TxnState *txn, Record *record);
+    ErrCode getBatch(IdxState *idxState, TxnState *txn, Record *records, size_t count, ErrCode *results);
     ErrCode getNext(IdxState *idxState, TxnState *txn, Record *record);
+    ErrCode getNextBatch(IdxState *idxState, TxnState *txn, Record *records, size_t count, size_t *produced);
+    ErrCode seekRange(IdxState *idxState, TxnState *txn, const KeyRange *range);
+    ErrCode scanRange(IdxState *idxState, TxnState *txn, const KeyRange *range, Record *records, size_t count, size_t *produced);
+    ErrCode getPrev(IdxState *idxState, TxnState *txn, Record *record);
+    ErrCode seekRangeDescending(IdxState *idxState, TxnState *txn, const KeyRange *range);
+    ErrCode scanRangeDescending(IdxState *idxState, TxnState *txn, const KeyRange *range, Record *records, size_t count, size_t *produced);
+    ErrCode prefixScan(IdxState *idxState, TxnState *txn, const char *prefix, Record *records, size_t count, size_t *produced);
+    ErrCode countRange(IdxState *idxState, const KeyRange *range, size_t *count);
+    ErrCode rankOfKey(IdxState *idxState, const Key *key, size_t *rank);
+    ErrCode selectKey(IdxState *idxState, size_t rank, Key *key);
     ErrCode insertRecord(IdxState *idxState, TxnState *txn, Key *k, const char* payload);
     ErrCode deleteRecord(IdxState *idxState, TxnState *txn, Record *record);
+    ErrCode updateRecord(IdxState *idxState, TxnState *txn, Key *k, const char *oldPayload, const char *newPayload);
+    ErrCode upsertRecord(IdxState *idxState, TxnState *txn, Key *k, const char *oldPayload, const char *newPayload);
+    ErrCode deleteRange(IdxState *idxState, const KeyRange *range, size_t *deleted);
+    ErrCode truncateIndex(IdxState *idxState);
+    ErrCode insertRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t rowId);
+    ErrCode getRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t *rowId);
+    ErrCode getNextRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t *rowId);
+    ErrCode deleteRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t rowId);
+    ErrCode getIndexStatistics(IdxState *idxState, IndexStatistics *stats);
+    ErrCode compactIndex(IdxState *idxState);
+    ErrCode bulkLoad(IdxState *idxState, const Record *records, size_t count, unsigned threads);
     uint32_t getTransactionID();
+    EpochManager& getEpochManager();
 
 private:
+    EpochManager epochManager;
     std::map<std::string, Tree*> tries;
     std::shared_mutex mtx;
 
@@ -0,0 +1,50 @@
+//
+// Created by lukas on 19.10.26.
+//
+
+#include "PayloadDictionary.h"
+
+uint32_t PayloadDictionary::find(const char *payload) const {
+    auto it = ids.find(std::string_view(payload));
+    return it == ids.end() ? NO_PAYLOAD : it->second;
+}
+
+uint32_t PayloadDictionary::acquire(const char *payload) {
+    auto it = ids.find(std::string_view(payload));
+    if (it != ids.end()) {
+        entries[it->second].references++;
+        return it->second;
+    }
+
+    uint32_t id;
+    if (!freeIds.empty()) {
+        id = freeIds.back();
+        freeIds.pop_back();
+        entries[id].payload = payload;
+    }
+    else {
+        id = entries.size();
+        entries.push_back(Entry {payload, 0});
+    }
+
+    entries[id].references = 1;
+    ids.emplace(std::string_view(entries[id].payload), id);
+    return id;
+}
+
+void PayloadDictionary::release(uint32_t id, uint64_t epoch) {
+    if (--entries[id].references > 0) {
+        return;
+    }
+
+    // The payload is not found anymore, but a view may still point at it
+    ids.erase(std::string_view(entries[id].payload));
+    retiredIds.retire(id, epoch);
+}
+
+void PayloadDictionary::collect(uint64_t safeEpoch) {
+    retiredIds.collect(safeEpoch, [this](uint32_t id) {
+        entries[id].payload = std::string {};
+        freeIds.push_back(id);
+    });
+}
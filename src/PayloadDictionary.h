@@ -0,0 +1,60 @@
+//
+// Created by lukas on 19.10.26.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Epoch.h"
+
+/*
+ * Interned payloads of one index.
+ *
+ * Every distinct payload is stored once and referenced by a 32 bit id from
+ * the entries of the index. An id is reference counted by those entries.
+ * Once the last reference is gone, the id is retired and only reused when
+ * no view can point at its payload anymore.
+ */
+class PayloadDictionary {
+public:
+    static constexpr uint32_t NO_PAYLOAD = UINT32_MAX;
+
+    // Id of an interned payload, NO_PAYLOAD if no entry references it
+    uint32_t find(const char *payload) const;
+
+    // Adds a reference to the payload, interning it first if needed
+    uint32_t acquire(const char *payload);
+    void release(uint32_t id, uint64_t epoch);
+
+    const char* payload(uint32_t id) const {
+        return entries[id].payload.c_str();
+    }
+
+    void collect(uint64_t safeEpoch);
+
+    bool hasRetiredIds() const {
+        return !retiredIds.empty();
+    }
+
+    size_t size() const {
+        return ids.size();
+    }
+
+private:
+    struct Entry {
+        std::string payload;
+        uint32_t references;
+    };
+
+    // A deque keeps the payloads in place while it grows, the keys of ids point into them
+    std::deque<Entry> entries;
+    std::unordered_map<std::string_view, uint32_t> ids;
+    std::vector<uint32_t> freeIds;
+    RetireList<uint32_t> retiredIds;
+};
@@ -0,0 +1,24 @@
+//
+// Created by lukas on 19.10.26.
+//
+
+#include "ReadGuard.h"
+
+#include "MemDB.h"
+
+ReadGuard::ReadGuard(MemDB& db, IdxState* idxState) : epochGuard(db.getEpochManager(), idxState->epoch), tree(idxState->tree),
+    finger(&idxState->finger) {
+    tree->acquireReadGuard();
+}
+
+ReadGuard::~ReadGuard() {
+    tree->releaseReadGuard();
+}
+
+ErrCode ReadGuard::get(TxnState* txn, const Key* key, RecordView* view) {
+    return tree->getView(txn, key, view, finger);
+}
+
+ErrCode ReadGuard::getNext(TxnState* txn, RecordView* view) {
+    return tree->getNextView(txn, view);
+}
@@ -0,0 +1,37 @@
+//
+// Created by lukas on 19.10.26.
+//
+
+#pragma once
+
+#include "Epoch.h"
+#include "Tree.h"
+
+class MemDB;
+
+/*
+ * Zero-copy reads of one index.
+ *
+ * The views returned by get and getNext point straight into the index. The
+ * guard keeps the thread of its IdxState inside an epoch, so deleted or
+ * updated entries are only unlinked and stay readable until the guard is
+ * destroyed. Holding a guard delays the reclamation of the whole database,
+ * so it should only live as long as the views are used.
+ */
+class ReadGuard {
+public:
+    ReadGuard(MemDB& db, IdxState* idxState);
+    ~ReadGuard();
+
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+
+    // Same results and cursor handling as MemDB::get and MemDB::getNext
+    ErrCode get(TxnState* txn, const Key* key, RecordView* view);
+    ErrCode getNext(TxnState* txn, RecordView* view);
+
+private:
+    EpochGuard epochGuard;
+    Tree* tree;
+    LookupFinger* finger;
+};
@@ -4,8 +4,16 @@
 
 #pragma once
 
+#include <memory>
+
 #include "server.h"
 
+// Payload and timestamp an in-place update replaced, an abort restores them
+struct BeforeImage {
+    char payload[MAX_PAYLOAD_LEN + 1];
+    uint32_t timestamp;
+};
+
 struct TransactionLogItem {
     TransactionLogItem(uint32_t transactionId, offset l1Offset, const char *payload, bool created) :
         transactionId(transactionId),
@@ -14,9 +22,27 @@ struct TransactionLogItem {
         strcpy(this->payload, payload);
     }
 
+    // An in-place update of an entry, the only kind of item with a before-image
+    TransactionLogItem(uint32_t transactionId, offset l1Offset, const char *payload, const char *oldPayload, uint32_t oldTimestamp) :
+        transactionId(transactionId),
+        l1Offset(l1Offset),
+        created(false),
+        before(std::make_unique<BeforeImage>()) {
+        strcpy(this->payload, payload);
+        strcpy(before->payload, oldPayload);
+        before->timestamp = oldTimestamp;
+    }
+
     uint32_t transactionId;
     offset l1Offset;
     char payload[MAX_PAYLOAD_LEN + 1];
-
     bool created;
-};
\ No newline at end of file
+    std::unique_ptr<BeforeImage> before;
+};
+
+// The insert of a row id of an index with row id payloads, the only change such an index logs
+struct RowIdLogItem {
+    uint32_t transactionId;
+    offset l1Offset;
+    uint64_t rowId;
+};
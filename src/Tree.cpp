@@ -5,10 +5,16 @@
 #include "Tree.h"
 
 #include <algorithm>
+#include <atomic>
 #include <iostream>
+#include <iterator>
 #include <string.h>
+#include <thread>
 
 #include <assert.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 #include "MemDB.h"
 
 #include "Transaction.h"
@@ -29,345 +35,1960 @@ uint32_t Tree::getTransactionId(TxnState *txn) {
     }
 }
 
-Tree::Tree(KeyType keyType, MemDB* memDb) : memDb(memDb), keyType(keyType), l0Items(), l1Items(), rootElementOffset(0) {
+Tree::Tree(KeyType keyType, MemDB* memDb, const IndexOptions& options) : memDb(memDb), keyType(keyType), options(options), l0Items(), l1Items(), activeReadGuards(0), rootElementOffset(0), structureVersion(0),
+    largestL1Item(NO_CHILD), largestL1ItemVersion(UINT64_MAX) {
+    if (this->options.rowIdPayloads) {
+        this->options.internPayloads = 0;
+    }
+    if (this->options.hotKeyCacheSize > 0 && !this->options.hashIndex) {
+        size_t slots = 1;
+        while (slots < (size_t) this->options.hotKeyCacheSize) {
+            slots *= 2;
+        }
+        hotKeys.resize(slots, NO_CHILD);
+    }
+    hotKeyHits = 0;
+    hotKeyMisses = 0;
+    keyFilterRejections = 0;
+    bulkLoadTasks = 0;
+    deferLogPurges = false;
+    initArenas();
+}
+
+void Tree::initArenas() {
     std::array<uint8_t, max_size()> fakeKey {};
 
+    if (options.keyFilter) {
+        keyFilter.reset(KEY_FILTER_INITIAL_KEYS);
+    }
+
     l0Items.emplace_back(L0Item {});
     l1Items.emplace_back(L1Item {fakeKey});
+    if (hasIdPayloads()) {
+        l1RowIds.emplace_back();
+    }
+    if (options.subtreeCounts) {
+        l0Counts.emplace_back(0);
+    }
 
     // TODO
     l0Items.reserve(1577798 + 1000);
     l1Items.reserve(129537 + 1000);
 }
 
-ErrCode Tree::get(TxnState *txn, Record *record) {
+ErrCode Tree::get(TxnState *txn, Record *record, LookupFinger *finger) {
     std::array<uint8_t, max_size()> keyData {};
-    prepareKeyData(&record->key, keyData.data());
+    encodeKey(&record->key, keyData.data());
+
+    return getEncoded(txn, keyData, record->payload, finger);
+}
+
+ErrCode Tree::getEncoded(TxnState *txn, const std::array<uint8_t, max_size()>& keyData, char *payload, LookupFinger *finger) {
+    // Row id indices have no string payloads
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
 
     std::lock_guard lock(this->mutex);
 
     auto transactionId = getTransactionId(txn);
-    auto l1Offset = findL1Item(keyData.data(), txn);
-    if (!isNodeVisitable(l1Offset)) {
+    auto position = txn ? &readPositions[txn->transactionId] : nullptr;
+    auto l1Offset = findL1Item(keyData.data(), finger);
+    if (position) {
+        positionAtKey(*position, keyData.data());
+    }
+
+    auto visiblePayload = findFirstVisible(position, transactionId, l1Offset);
+    if (!visiblePayload) {
         return KEY_NOTFOUND;
     }
-    auto l1Item = &accessL1Item(l1Offset);
-    for (auto l2Item = l1Item->items.begin(); l2Item != std::end(l1Item->items); l2Item++) {
 
-        // TODO: Refactor!
-        if (((l2Item->timestamp < transactionId) && !isTransactionActive(l2Item->timestamp)) || l2Item->timestamp == transactionId) {
-            strcpy(record->payload, l2Item->payload);
+    strcpy(payload, visiblePayload);
+    return SUCCESS;
+}
+
+ErrCode Tree::getBatch(TxnState *txn, Record *records, size_t count, ErrCode *results) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
 
-            if (txn) {
-                txn->firstCall = false;
-                readPositions[txn->transactionId].l2Iterator = ++l2Item;
-                if (readPositions[txn->transactionId].l2Iterator == std::end(l1Item->items)) {
-                    readPositions[txn->transactionId].hasMoreL2Items = false;
-                }
-                else {
-                    readPositions[txn->transactionId].hasMoreL2Items = true;
+    const size_t keySize = SIZES[this->keyType];
+    std::vector<uint8_t> keys(count * keySize);
+    std::array<uint8_t, max_size()> keyData {};
+    for (size_t i = 0; i < count; i++) {
+        keyData.fill(0);
+        encodeKey(&records[i].key, keyData.data());
+        memcpy(keys.data() + i * keySize, keyData.data(), keySize);
+    }
+
+    std::lock_guard lock(this->mutex);
+    auto transactionId = getTransactionId(txn);
+    auto position = txn ? &readPositions[txn->transactionId] : nullptr;
+    bool simd = canTraverseBatchSimd();
+
+    // The lookups of a group advance one level per round, every round issues the prefetches for the next one
+    for (size_t groupStart = 0; groupStart < count; groupStart += GET_BATCH_GROUP_SIZE) {
+        size_t groupSize = std::min(GET_BATCH_GROUP_SIZE, count - groupStart);
+
+        std::array<BatchLookup, GET_BATCH_GROUP_SIZE> lookups {};
+        size_t active = groupSize;
+        if (simd) {
+            // The kernel leaves every lookup either in VERIFY or DONE
+            traverseBatchSimd(keys.data() + groupStart * keySize, groupSize, lookups.data());
+            active = std::count_if(lookups.begin(), lookups.begin() + groupSize, [](const BatchLookup& lookup) {
+                return lookup.state != BatchLookupState::DONE;
+            });
+        }
+        else {
+            for (size_t j = 0; j < groupSize; j++) {
+                lookups[j].current = rootElementOffset;
+            }
+        }
+
+        while (active > 0) {
+            for (size_t j = 0; j < groupSize; j++) {
+                auto& lookup = lookups[j];
+                const uint8_t* key = keys.data() + (groupStart + j) * keySize;
+
+                switch (lookup.state) {
+                    case BatchLookupState::TRAVERSE: {
+                        offset child = accessL0Item(lookup.current).children[calculateIndex(key, lookup.level)];
+
+                        if (isL1Node(child) && isNodeVisitable(child)) {
+                            lookup.current = child;
+                            lookup.state = BatchLookupState::VERIFY;
+                            __builtin_prefetch(&accessL1Item(child));
+                        }
+                        else if (!isNodeVisitable(child)) {
+                            lookup.current = NO_CHILD;
+                            lookup.state = BatchLookupState::DONE;
+                            active--;
+                        }
+                        else {
+                            lookup.current = child;
+                            lookup.level++;
+                            __builtin_prefetch(&accessL0Item(child));
+                        }
+                        break;
+                    }
+
+                    case BatchLookupState::VERIFY: {
+                        auto l1Item = &accessL1Item(lookup.current);
+                        if (memcmp(key, l1Item->keyData.data(), keySize) != 0) {
+                            lookup.current = NO_CHILD;
+                        }
+                        else if (!l1Item->items.empty()) {
+                            __builtin_prefetch(&l1Item->items.front());
+                        }
+
+                        lookup.state = BatchLookupState::DONE;
+                        active--;
+                        break;
+                    }
+
+                    case BatchLookupState::DONE:
+                        break;
                 }
-                readPositions[txn->transactionId].l1Offset = l1Offset;
             }
+        }
 
-            return SUCCESS;
+        for (size_t j = 0; j < groupSize; j++) {
+            // Only the last get of a sequence decides where the cursor ends up
+            if (position && groupStart + j == count - 1) {
+                positionAtKey(*position, keys.data() + (count - 1) * keySize);
+            }
+            results[groupStart + j] = readFirstVisible(position, transactionId, lookups[j].current, &records[groupStart + j]);
         }
     }
 
-    return KEY_NOTFOUND;
+    return SUCCESS;
 }
 
-bool Tree::isTransactionActive(uint32_t transactionID) {
-    return readPositions.count(transactionID) > 0;
+bool Tree::canTraverseBatchSimd() {
+#if defined(__x86_64__)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+
+    // The gather indices (offset * 16 + nibble) have to fit into signed 32 bit lanes
+    return avx2 && this->keyType != VARCHAR && l0Items.size() < (1u << 27);
+#else
+    return false;
+#endif
 }
 
-ErrCode Tree::getNext(TxnState *txn, Record *record) {
-    std::lock_guard lock(this->mutex);
-    auto transactionId = getTransactionId(txn);
+#if defined(__x86_64__)
+__attribute__((target("avx2")))
+void Tree::traverseBatchSimd(const uint8_t* keys, size_t count, BatchLookup* lookups) {
+    const size_t keySize = SIZES[this->keyType];
+    const uint32_t levels = LEVELS[this->keyType];
+    const int* children = reinterpret_cast<const int*>(l0Items.data());
+    static_assert(sizeof(L0Item) == 16 * sizeof(offset), "the gather kernel expects densely packed L0 items");
+
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i nibbleMask = _mm256_set1_epi32(0xF);
+    const __m256i l1Flag = _mm256_set1_epi32(0x40000000);
+    const __m256i laneIds = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    // All vectors of the group advance one level at a time, so their gathers are in flight together
+    constexpr size_t vectors = GET_BATCH_GROUP_SIZE / SIMD_LANES;
+    assert(count <= GET_BATCH_GROUP_SIZE);
+
+    // Keys are big endian, so the first levels are the high nibbles of the first word
+    alignas(32) uint32_t words[2][GET_BATCH_GROUP_SIZE] {};
+    for (size_t j = 0; j < count; j++) {
+        const uint8_t* key = keys + j * keySize;
+        for (size_t w = 0; w < keySize / sizeof(uint32_t); w++) {
+            uint32_t word;
+            memcpy(&word, key + w * sizeof(uint32_t), sizeof(uint32_t));
+            words[w][j] = __builtin_bswap32(word);
+        }
+    }
 
-    while (true) {
-        offset l1Offset;
+    __m256i current[vectors];
+    __m256i active[vectors];
+    __m256i result[vectors];
+    for (size_t v = 0; v < vectors; v++) {
+        current[v] = _mm256_set1_epi32((int) rootElementOffset);
+        active[v] = _mm256_cmpgt_epi32(_mm256_set1_epi32((int) count - (int) (v * SIMD_LANES)), laneIds);
+        result[v] = zero;
+    }
+
+    for (uint32_t level = 0; level < levels; level++) {
+        __m128i shift = _mm_cvtsi32_si128(28 - 4 * (level % 8));
+        bool anyActive = false;
 
-        std::list<L2Item>::iterator l2Item {};
+        for (size_t v = 0; v < vectors; v++) {
+            if (_mm256_testz_si256(active[v], active[v])) {
+                continue;
+            }
+            anyActive = true;
+
+            __m256i word = _mm256_load_si256(reinterpret_cast<const __m256i*>(&words[level < 8 ? 0 : 1][v * SIMD_LANES]));
+            __m256i nibbles = _mm256_and_si256(_mm256_srl_epi32(word, shift), nibbleMask);
+            __m256i index = _mm256_add_epi32(_mm256_slli_epi32(current[v], 4), nibbles);
+            __m256i child = _mm256_mask_i32gather_epi32(zero, children, index, active[v], 4);
 
-        if (!txn) {
-            l1Offset = findL1ItemWithSmallestKey();
+            // Same cases as findL1Item: an L1 ends the traversal, so does an empty or not visitable slot
+            __m256i isL1 = _mm256_cmpeq_epi32(_mm256_and_si256(child, l1Flag), l1Flag);
+            __m256i missing = _mm256_or_si256(_mm256_cmpeq_epi32(child, zero), _mm256_srai_epi32(child, 31));
+            __m256i finished = _mm256_and_si256(active[v], _mm256_or_si256(isL1, missing));
 
+            result[v] = _mm256_or_si256(result[v], _mm256_andnot_si256(missing, _mm256_and_si256(finished, child)));
+            active[v] = _mm256_andnot_si256(finished, active[v]);
+            current[v] = _mm256_blendv_epi8(current[v], child, active[v]);
         }
-        else if (txn->firstCall) {
-            uint32_t _ = 0;
-            l1Offset = recursiveFindL1(txn, 0, &accessL0Item(rootElementOffset), &_);
-            txn->firstCall = false;
+
+        if (!anyActive) {
+            break;
         }
-        else if (readPositions[txn->transactionId].hasMoreL2Items) {
-            l1Offset = readPositions[txn->transactionId].l1Offset;
+    }
+
+    alignas(32) offset candidates[GET_BATCH_GROUP_SIZE];
+    for (size_t v = 0; v < vectors; v++) {
+        _mm256_store_si256(reinterpret_cast<__m256i*>(&candidates[v * SIMD_LANES]), result[v]);
+    }
+    for (size_t j = 0; j < count; j++) {
+        auto& lookup = lookups[j];
+        lookup.current = candidates[j];
+        lookup.level = levels;
+        if (isNodeVisitable(candidates[j])) {
+            lookup.state = BatchLookupState::VERIFY;
+            __builtin_prefetch(&accessL1Item(candidates[j]));
         }
         else {
-            uint32_t _ = 0;
-            l1Offset = recursiveFindL1(txn, 0, &accessL0Item(rootElementOffset), &_);
+            lookup.state = BatchLookupState::DONE;
         }
+    }
+}
+#else
+void Tree::traverseBatchSimd(const uint8_t*, size_t, BatchLookup*) {
+}
+#endif
 
-        if (!isL1Node(l1Offset)) {
-            return DB_END;
-        }
+ErrCode Tree::readFirstVisible(ReadPosition* position, uint32_t transactionId, offset l1Offset, Record *record) {
+    auto payload = findFirstVisible(position, transactionId, l1Offset);
+    if (!payload) {
+        return KEY_NOTFOUND;
+    }
 
-        auto l1Item = &accessL1Item(l1Offset);
+    strcpy(record->payload, payload);
+    return SUCCESS;
+}
+
+const char* Tree::findFirstVisible(ReadPosition* position, uint32_t transactionId, offset l1Offset) {
+    if (!isNodeVisitable(l1Offset)) {
+        return nullptr;
+    }
 
-        if (txn && readPositions[txn->transactionId].hasMoreL2Items) {
-            l2Item = readPositions[txn->transactionId].l2Iterator;
+    if (options.internPayloads) {
+        ReadPosition temporary;
+        auto& rowIdPosition = position ? *position : temporary;
+        rowIdPosition.firstCall = false;
+        rowIdPosition.hasMoreL2Items = false;
+        if (!findVisibleRowId(rowIdPosition, transactionId, l1Offset)) {
+            return nullptr;
         }
-        else {
-            l2Item = l1Item->items.begin();
+        return dictionary.payload(accessRowIds(l1Offset)[rowIdPosition.rowIdIndex - 1].rowId);
+    }
+
+    auto l1Item = &accessL1Item(l1Offset);
+    for (auto l2Item = l1Item->items.begin(); l2Item != std::end(l1Item->items); l2Item++) {
+
+        if (isVisible(*l2Item, transactionId)) {
+            if (position) {
+                position->firstCall = false;
+                position->l2Iterator = std::next(l2Item);
+                position->hasMoreL2Items = position->l2Iterator != std::end(l1Item->items);
+                position->l1Offset = l1Offset;
+            }
+
+            return l2Item->payload;
         }
+    }
 
-        for (; l2Item != l1Item->items.end(); l2Item++) {
-            // TODO: Refactor!
-            if (((l2Item->timestamp < transactionId) && !isTransactionActive(l2Item->timestamp)) || l2Item->timestamp == transactionId) {
-                strcpy(record->payload, l2Item->payload);
-                record->key.type = keyType;
+    return nullptr;
+}
 
-                switch (keyType) {
-                    case KeyType::SHORT:
-                        record->key.keyval.shortkey = charArrayToInt32(l1Item->keyData.data());
-                        break;
-                    case KeyType::INT:
+bool Tree::isTransactionActive(uint32_t transactionID) {
+    return readPositions.count(transactionID) > 0;
+}
 
-                        record->key.keyval.intkey = charArrayToInt64(l1Item->keyData.data());
-                        break;
-                    case KeyType::VARCHAR: {
-                        uint8_t* ptr = l1Item->keyData.data();
-                        uint32_t index = 0;
-                        while (index < MAX_VARCHAR_LEN) {
-                            if (ptr[index]) {
-                                break;
-                            }
-                            index++;
-                        }
-                        size_t len = MAX_VARCHAR_LEN - index;
-                        ptr += index;
-                        strncpy(record->key.keyval.charkey, (char*) ptr, len);
-                        record->key.keyval.charkey[len] = '\0';
-                    }
-                        break;
-                    default:
-                        return FAILURE;
-                }
+bool Tree::isVisible(const L2Item& l2Item, uint32_t transactionId) {
+    return isVisible(l2Item.timestamp, transactionId);
+}
 
-                if (txn) {
-                    readPositions[txn->transactionId].l2Iterator = ++l2Item;
-                    if (readPositions[txn->transactionId].l2Iterator == std::end(l1Item->items)) {
-                        readPositions[txn->transactionId].hasMoreL2Items = false;
-                    }
-                    else {
-                        readPositions[txn->transactionId].hasMoreL2Items = true;
-                    }
+bool Tree::isVisible(uint32_t timestamp, uint32_t transactionId) {
+    return ((timestamp < transactionId) && !isTransactionActive(timestamp)) || timestamp == transactionId;
+}
 
-                    readPositions[txn->transactionId].l1Offset = l1Offset;
-                }
+ErrCode Tree::getView(TxnState *txn, const Key *key, RecordView *view, LookupFinger *finger) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
 
-                return SUCCESS;
-            }
+    std::array<uint8_t, max_size()> keyData {};
+    encodeKey(key, keyData.data());
+
+    std::lock_guard lock(this->mutex);
+
+    auto transactionId = getTransactionId(txn);
+    auto position = txn ? &readPositions[txn->transactionId] : nullptr;
+    auto l1Offset = findL1Item(keyData.data(), finger);
+    if (position) {
+        positionAtKey(*position, keyData.data());
+    }
+
+    auto payload = findFirstVisible(position, transactionId, l1Offset);
+    if (!payload) {
+        return KEY_NOTFOUND;
+    }
+
+    viewRecord(accessL1Item(l1Offset), payload, view);
+    return SUCCESS;
+}
+
+ErrCode Tree::getNextEncoded(TxnState *txn, std::array<uint8_t, max_size()>& keyData, char *payload) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    std::lock_guard lock(this->mutex);
+    auto transactionId = getTransactionId(txn);
+
+    offset l1Offset = NO_CHILD;
+    const char* visiblePayload = nullptr;
+    if (!txn) {
+        l1Offset = findL1ItemWithSmallestKey();
+        visiblePayload = findFirstVisible(nullptr, transactionId, l1Offset);
+        if (!visiblePayload) {
+            return DB_END;
+        }
+    }
+    else {
+        auto& position = readPositions[txn->transactionId];
+        auto result = findNextVisible(position, transactionId, false, &visiblePayload);
+        if (result != SUCCESS) {
+            return result;
         }
+        l1Offset = position.l1Offset;
+    }
 
-        if (txn) {
-            readPositions[txn->transactionId].hasMoreL2Items = false;
+    memcpy(keyData.data(), accessL1Item(l1Offset).keyData.data(), SIZES[this->keyType]);
+    strcpy(payload, visiblePayload);
+    return SUCCESS;
+}
+
+ErrCode Tree::getNextView(TxnState *txn, RecordView *view) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    std::lock_guard lock(this->mutex);
+    auto transactionId = getTransactionId(txn);
+
+    if (!txn) {
+        auto l1Offset = findL1ItemWithSmallestKey();
+        auto payload = findFirstVisible(nullptr, transactionId, l1Offset);
+        if (!payload) {
+            return DB_END;
         }
+        viewRecord(accessL1Item(l1Offset), payload, view);
+        return SUCCESS;
     }
 
+    auto& position = readPositions[txn->transactionId];
+    const char* payload = nullptr;
+    auto result = findNextVisible(position, transactionId, false, &payload);
+    if (result == SUCCESS) {
+        viewRecord(accessL1Item(position.l1Offset), payload, view);
+    }
+
+    return result;
+}
+
+void Tree::viewRecord(const L1Item& l1Item, const char *payload, RecordView *view) {
+    const uint8_t* keyData = l1Item.keyData.data();
+    view->key.type = this->keyType;
+    view->key.intkey = 0;
+    view->key.charkey = {};
+
+    switch (this->keyType) {
+        case KeyType::SHORT:
+            view->key.intkey = charArrayToInt32(keyData);
+            break;
+        case KeyType::INT:
+            view->key.intkey = charArrayToInt64(keyData);
+            break;
+        case KeyType::VARCHAR:
+            // Both encodings hold the characters contiguously, only the padding differs
+            if (options.leftAlignedVarchar) {
+                view->key.charkey = std::string_view((const char*) keyData, strnlen((const char*) keyData, MAX_VARCHAR_LEN));
+            }
+            else {
+                size_t offset = varcharPaddingLength(keyData);
+                view->key.charkey = std::string_view((const char*) keyData + offset, MAX_VARCHAR_LEN - offset);
+            }
+            break;
+    }
 
-    return DB_END;
+    view->payload = std::string_view(payload);
 }
 
+void Tree::acquireReadGuard() {
+    activeReadGuards++;
+}
 
-ErrCode Tree::insertRecord(TxnState *txn, Key *k, const char *payload) {
-    std::array<uint8_t, max_size()> keyData {};
-    prepareKeyData(k, keyData.data());
+void Tree::releaseReadGuard() {
+    activeReadGuards--;
+}
+
+ErrCode Tree::getNext(TxnState *txn, Record *record) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
 
     std::lock_guard lock(this->mutex);
+    auto transactionId = getTransactionId(txn);
+
+    if (!txn) {
+        auto l1Offset = findL1ItemWithSmallestKey();
+        if (readFirstVisible(nullptr, transactionId, l1Offset, record) != SUCCESS) {
+            return DB_END;
+        }
+        decodeKey(accessL1Item(l1Offset), &record->key);
+        return SUCCESS;
+    }
+
+    return scanLocked(readPositions[txn->transactionId], transactionId, record, false);
+}
+
+ErrCode Tree::getPrev(TxnState *txn, Record *record) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
 
+    std::lock_guard lock(this->mutex);
     auto transactionId = getTransactionId(txn);
-    auto l1Offset = findOrConstructL1Item(keyData);
-    auto l1Item = &accessL1Item(l1Offset);
 
-    for (const auto& l2 : l1Item->items) {
-        if (strcmp(l2.payload, payload) == 0) {
-            return ENTRY_EXISTS;
+    if (!txn) {
+        auto l1Offset = findL1ItemWithLargestKey();
+        if (readFirstVisible(nullptr, transactionId, l1Offset, record) != SUCCESS) {
+            return DB_END;
         }
+        decodeKey(accessL1Item(l1Offset), &record->key);
+        return SUCCESS;
     }
 
-    l1Item->items.emplace_back(L2Item (payload, transactionId));
+    return scanLocked(readPositions[txn->transactionId], transactionId, record, true);
+}
 
-    if (txn) {
-        this->transactionLogItems.emplace_back(transactionId, l1Offset, payload, true);
+ErrCode Tree::getNextBatch(TxnState *txn, Record *records, size_t count, size_t *produced) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
     }
 
+    std::lock_guard lock(this->mutex);
+    auto transactionId = getTransactionId(txn);
+
+    // Without a transaction the batch scans from the smallest key with a cursor of its own
+    ReadPosition temporary;
+    auto& position = txn ? readPositions[txn->transactionId] : temporary;
+
+    return scanBatchLocked(position, transactionId, records, count, produced, false);
+}
+
+ErrCode Tree::seekRange(TxnState *txn, const KeyRange *range, bool descending) {
+    if (!txn) {
+        return FAILURE;
+    }
 
+    std::lock_guard lock(this->mutex);
+    getTransactionId(txn);
+    seekLocked(readPositions[txn->transactionId], range, descending);
     return SUCCESS;
 }
 
-ErrCode Tree::deleteRecord(TxnState *txn, Record *record) {
-    std::array<uint8_t, max_size()> keyData {};
-    prepareKeyData(&record->key, keyData.data());
+ErrCode Tree::scanRange(TxnState *txn, const KeyRange *range, bool descending, Record *records, size_t count, size_t *produced) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
 
     std::lock_guard lock(this->mutex);
-//    auto transactionId = getTransactionId(txn, db);
+    auto transactionId = getTransactionId(txn);
 
-    char* payload = nullptr;
-    if (strnlen(record->payload, MAX_PAYLOAD_LEN)) {
-        payload = record->payload;
+    ReadPosition temporary;
+    auto& position = txn ? readPositions[txn->transactionId] : temporary;
+
+    seekLocked(position, range, descending);
+    return scanBatchLocked(position, transactionId, records, count, produced, descending);
+}
+
+ErrCode Tree::prefixScan(TxnState *txn, const char *prefix, Record *records, size_t count, size_t *produced) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
     }
 
-    auto l0Item = &accessL0Item(rootElementOffset);
-    auto result = recursiveDelete(0, l0Item, keyData.data(), payload);
-    switch (result) {
-        case RecursiveDeleteResult::ENTRY_NOT_FOUND:
-            return ENTRY_DNE;
-        case RecursiveDeleteResult::KEY_NOT_FOUND:
-            return KEY_NOTFOUND;
-        default:
-            return SUCCESS;
+    // Only left-aligned keys sharing a prefix share a subtree, right-aligned ones are spread by their length
+    if (this->keyType != VARCHAR || !options.leftAlignedVarchar) {
+        return FAILURE;
     }
+
+    KeyRange range {};
+    range.low.type = VARCHAR;
+    strncpy(range.low.keyval.charkey, prefix, MAX_VARCHAR_LEN);
+    range.low.keyval.charkey[MAX_VARCHAR_LEN] = '\0';
+    range.lowType = INCLUSIVE;
+
+    // The range ends in front of the smallest string larger than every extension of the prefix
+    range.high = range.low;
+    range.highType = UNBOUNDED;
+    auto successor = reinterpret_cast<uint8_t*>(range.high.keyval.charkey);
+    for (size_t len = strlen(range.high.keyval.charkey); len > 0; len--) {
+        if (successor[len - 1] != 0xFF) {
+            successor[len - 1]++;
+            successor[len] = '\0';
+            range.highType = EXCLUSIVE;
+            break;
+        }
+    }
+
+    std::lock_guard lock(this->mutex);
+    auto transactionId = getTransactionId(txn);
+
+    ReadPosition temporary;
+    auto& position = txn ? readPositions[txn->transactionId] : temporary;
+
+    seekLocked(position, &range, false);
+    return scanBatchLocked(position, transactionId, records, count, produced, false);
 }
 
-RecursiveDeleteResult Tree::recursiveDelete(uint32_t level, L0Item* l0Item, const uint8_t *keyData, const char* payload) {
-    if (level == LEVELS[this->keyType]) {
-        assert(false);
+ErrCode Tree::scanBatchLocked(ReadPosition& position, uint32_t transactionId, Record *records, size_t count, size_t *produced, bool descending) {
+    size_t i = 0;
+    while (i < count && scanLocked(position, transactionId, &records[i], descending) == SUCCESS) {
+        i++;
     }
 
-    offset index = calculateIndex(keyData, level);
+    *produced = i;
+    return i > 0 || count == 0 ? SUCCESS : DB_END;
+}
 
-    if (isL1Node(l0Item->children[index])) {
-        offset l1Offset = l0Item->children[index];
-        // Delete element!
-        if (isNodeVisitable(l1Offset)) {
-            auto l1Item = &accessL1Item(l1Offset);
+void Tree::seekLocked(ReadPosition& position, const KeyRange *range, bool descending) {
+    // A descending scan starts at the upper bound and ends at the lower one
+    const Key& start = descending ? range->high : range->low;
+    BoundType startType = descending ? range->highType : range->lowType;
+    const Key& end = descending ? range->low : range->high;
+    BoundType endType = descending ? range->lowType : range->highType;
+
+    position.firstCall = false;
+    position.hasMoreL2Items = false;
+    position.seekPending = false;
+    position.descending = descending;
+    position.ranged = true;
+    position.rangeEnded = false;
+    position.bounded = endType != UNBOUNDED;
+    position.boundInclusive = endType == INCLUSIVE;
+    position.bound.fill(0);
+    if (position.bounded) {
+        encodeKey(&end, position.bound.data());
+    }
 
-            if (!payload) {
-                for (auto& readPosition : readPositions) {
-                    if (readPosition.second.l1Offset == l1Offset) {
-                        readPosition.second.hasMoreL2Items = false;
-                    }
-                }
+    if (startType == UNBOUNDED) {
+        resetTrace(position);
+        return;
+    }
 
-                l1Item->items.clear();
-                l0Item->children[index] = markAsNotVisitable(l1Offset);
-                return RecursiveDeleteResult::ALL_DELETED;
-            }
+    position.anchorKey.fill(0);
+    encodeKey(&start, position.anchorKey.data());
+    position.anchorInclusive = startType == INCLUSIVE;
+    seekTrace(position, position.anchorKey.data(), position.anchorInclusive);
+}
 
+void Tree::positionAtKey(ReadPosition& position, const uint8_t *keyData) {
+    // The scan continues behind the key in whichever direction it goes next, the trace is only set up then
+    position.firstCall = false;
+    position.hasMoreL2Items = false;
+    position.seekPending = true;
+    memcpy(position.anchorKey.data(), keyData, SIZES[this->keyType]);
+    position.anchorInclusive = false;
+    position.ranged = false;
+    position.bounded = false;
+    position.rangeEnded = false;
+}
 
-            for (auto it = l1Item->items.begin(); it != l1Item->items.end(); it++) {
-                if (strcmp(it->payload, payload) == 0) {
+void Tree::resetTrace(ReadPosition& position) {
+    position.traversalTrace.fill(position.descending ? 16 : 0);
+    position.pathDepth = 0;
+    position.exhausted = false;
+}
 
-                    for (auto& readPosition : readPositions) {
-                        if (readPosition.second.l1Offset == l1Offset && readPosition.second.l2Iterator == it) {
-                            readPosition.second.l2Iterator = ++readPosition.second.l2Iterator;
-                        }
-                    }
+void Tree::seekTrace(ReadPosition& position, const uint8_t *keyData, bool inclusive) {
+    const size_t keySize = SIZES[this->keyType];
+    const bool descending = position.descending;
 
-                    l1Item->items.erase(it);
-                    if (l1Item->items.empty()) {
-                        l0Item->children[index] = markAsNotVisitable(l1Offset);
+    // The levels below the seek path start from their first child
+    resetTrace(position);
 
-                        for (auto& readPosition : readPositions) {
-                            if (readPosition.second.l1Offset == l1Offset) {
-                                readPosition.second.hasMoreL2Items = false;
-                            }
-                        }
+    auto& trace = position.traversalTrace;
+    auto& path = position.path;
+    path[0] = rootElementOffset;
 
-                        return RecursiveDeleteResult::ALL_DELETED;
-                    }
-                    return RecursiveDeleteResult::ONE_DELETED;
-                }
+    uint32_t level = 0;
+    while (true) {
+        uint32_t index = calculateIndex(keyData, level);
+        offset child = accessL0Item(path[level]).children[index];
+
+        if (isL1Node(child) && isNodeVisitable(child)) {
+            int cmp = memcmp(accessL1Item(child).keyData.data(), keyData, keySize);
+            if (descending) {
+                bool included = cmp < 0 || (cmp == 0 && inclusive);
+                trace[level] = included ? index + 1 : index;
+            }
+            else {
+                // 16 is fine here, the scan carries it into the level above
+                bool included = cmp > 0 || (cmp == 0 && inclusive);
+                trace[level] = included ? index : index + 1;
             }
+            break;
+        }
 
-            return RecursiveDeleteResult::ENTRY_NOT_FOUND;
+        // Every key in the following slots is past the seek key
+        trace[level] = descending ? index + 1 : index;
+        if (!isNodeVisitable(child)) {
+            break;
         }
-    }
 
-    if (!isNodeVisitable(l0Item->children[index])) {
-        return RecursiveDeleteResult::KEY_NOT_FOUND;
+        path[level + 1] = child;
+        level++;
     }
 
-    L0Item* next = &accessL0Item(l0Item->children[index]);
-    auto result = recursiveDelete(level + 1, next, keyData, payload);
+    position.pathDepth = level + 1;
+    position.pathVersion = structureVersion;
+}
 
-    switch (result) {
-        case RecursiveDeleteResult::ALL_DELETED: {
-            l0Item->children[index] = markAsNotVisitable(l0Item->children[index]);
+bool Tree::isPastBound(const ReadPosition& position, const L1Item& l1Item) {
+    int cmp = memcmp(l1Item.keyData.data(), position.bound.data(), SIZES[this->keyType]);
+    if (position.descending) {
+        return cmp < 0 || (cmp == 0 && !position.boundInclusive);
+    }
+    return cmp > 0 || (cmp == 0 && !position.boundInclusive);
+}
 
-            bool anyoneVisitable = false;
-            for (auto i = 0; i < 16; i++) {
-                if (isNodeVisitable(l0Item->children[i])) {
-                    anyoneVisitable = true;
-                    break;
-                }
-            }
+ErrCode Tree::scanLocked(ReadPosition& position, uint32_t transactionId, Record *record, bool descending) {
+    const char* payload = nullptr;
+    auto result = findNextVisible(position, transactionId, descending, &payload);
+    if (result == SUCCESS) {
+        strcpy(record->payload, payload);
+        decodeKey(accessL1Item(position.l1Offset), &record->key);
+    }
 
-            return anyoneVisitable ? RecursiveDeleteResult::ONE_DELETED : RecursiveDeleteResult::ALL_DELETED;
-        }
+    return result;
+}
 
-        case RecursiveDeleteResult::ONE_DELETED:
+// Advances the cursor to the next visible entry, which is left in position.l1Offset and payload
+ErrCode Tree::findNextVisible(ReadPosition& position, uint32_t transactionId, bool descending, const char** payload) {
+    if (position.descending != descending) {
+        // Turning around continues from the last key in the other direction, without the bounds of a range
+        position.descending = descending;
+        position.hasMoreL2Items = false;
+        position.seekPending = !position.firstCall;
+        position.ranged = false;
+        position.bounded = false;
+        position.rangeEnded = false;
+        resetTrace(position);
+    }
+
+    if (position.rangeEnded) {
+        return DB_END;
+    }
+
+    if (position.seekPending) {
+        seekTrace(position, position.anchorKey.data(), position.anchorInclusive);
+        position.seekPending = false;
+    }
+
+    while (true) {
+        offset l1Offset;
+
+        if (position.firstCall) {
+            l1Offset = findAdjacentL1Item(&position);
+            position.firstCall = false;
+        }
+        else if (position.hasMoreL2Items) {
+            l1Offset = position.l1Offset;
+        }
+        else {
+            l1Offset = findAdjacentL1Item(&position);
+        }
+
+        if (!isL1Node(l1Offset)) {
+            position.rangeEnded = position.ranged;
+            return DB_END;
+        }
+
+        auto l1Item = &accessL1Item(l1Offset);
+        if (position.bounded && isPastBound(position, *l1Item)) {
+            position.rangeEnded = true;
+            return DB_END;
+        }
+
+        if (hasIdPayloads()) {
+            if (findVisibleRowId(position, transactionId, l1Offset)) {
+                if (options.internPayloads) {
+                    *payload = dictionary.payload(accessRowIds(l1Offset)[position.rowIdIndex - 1].rowId);
+                }
+                return SUCCESS;
+            }
+            continue;
+        }
+
+        auto it = position.hasMoreL2Items ? position.l2Iterator : l1Item->items.begin();
+
+        for (; it != l1Item->items.end(); it++) {
+            if (isVisible(*it, transactionId)) {
+                *payload = it->payload;
+                memcpy(position.anchorKey.data(), l1Item->keyData.data(), SIZES[this->keyType]);
+                position.anchorInclusive = false;
+
+                position.l2Iterator = std::next(it);
+                position.hasMoreL2Items = position.l2Iterator != std::end(l1Item->items);
+                position.l1Offset = l1Offset;
+
+                return SUCCESS;
+            }
+        }
+
+        position.hasMoreL2Items = false;
+    }
+}
+
+// Row id counterpart of the payload loop of findNextVisible, the row id is the one in front of position.rowIdIndex
+bool Tree::findVisibleRowId(ReadPosition& position, uint32_t transactionId, offset l1Offset) {
+    auto& rowIds = accessRowIds(l1Offset);
+    for (size_t i = position.hasMoreL2Items ? position.rowIdIndex : 0; i < rowIds.size(); i++) {
+        if (isVisible(rowIds[i].timestamp, transactionId)) {
+            memcpy(position.anchorKey.data(), accessL1Item(l1Offset).keyData.data(), SIZES[this->keyType]);
+            position.anchorInclusive = false;
+
+            position.rowIdIndex = i + 1;
+            position.hasMoreL2Items = position.rowIdIndex < rowIds.size();
+            position.l1Offset = l1Offset;
+            return true;
+        }
+    }
+
+    position.hasMoreL2Items = false;
+    return false;
+}
+
+ErrCode Tree::insertRowId(TxnState *txn, Key *k, uint64_t rowId) {
+    if (!options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    std::array<uint8_t, max_size()> keyData {};
+    encodeKey(k, keyData.data());
+
+    std::lock_guard lock(this->mutex);
+
+    auto transactionId = getTransactionId(txn);
+    auto l1Offset = findOrConstructL1Item(keyData);
+    auto& rowIds = accessRowIds(l1Offset);
+
+    // A plain loop over the integers, the compiler vectorizes it
+    bool exists = false;
+    for (const auto& item : rowIds) {
+        exists |= item.rowId == rowId;
+    }
+    if (exists) {
+        return ENTRY_EXISTS;
+    }
+
+    rowIds.push_back(RowIdItem {rowId, transactionId});
+    if (txn) {
+        this->rowIdLogItems.push_back(RowIdLogItem {transactionId, l1Offset, rowId});
+    }
+
+    return SUCCESS;
+}
+
+ErrCode Tree::getRowId(TxnState *txn, Key *k, uint64_t *rowId) {
+    if (!options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    std::array<uint8_t, max_size()> keyData {};
+    encodeKey(k, keyData.data());
+
+    std::lock_guard lock(this->mutex);
+
+    auto transactionId = getTransactionId(txn);
+    auto l1Offset = findL1Item(keyData.data());
+    ReadPosition temporary;
+    auto& position = txn ? readPositions[txn->transactionId] : temporary;
+    positionAtKey(position, keyData.data());
+
+    if (!isNodeVisitable(l1Offset) || !findVisibleRowId(position, transactionId, l1Offset)) {
+        return KEY_NOTFOUND;
+    }
+
+    *rowId = accessRowIds(l1Offset)[position.rowIdIndex - 1].rowId;
+    return SUCCESS;
+}
+
+ErrCode Tree::getNextRowId(TxnState *txn, Key *k, uint64_t *rowId) {
+    if (!options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    std::lock_guard lock(this->mutex);
+    auto transactionId = getTransactionId(txn);
+
+    ReadPosition temporary;
+    auto& position = txn ? readPositions[txn->transactionId] : temporary;
+    const char* payload = nullptr;
+    auto result = findNextVisible(position, transactionId, false, &payload);
+    if (result != SUCCESS) {
+        return result;
+    }
+
+    auto& l1Item = accessL1Item(position.l1Offset);
+    *rowId = accessRowIds(position.l1Offset)[position.rowIdIndex - 1].rowId;
+    decodeKey(l1Item, k);
+    return SUCCESS;
+}
+
+// Like the deletes of records, the delete is not logged and takes effect immediately
+ErrCode Tree::deleteRowId(TxnState *, Key *k, uint64_t rowId) {
+    if (!options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    std::array<uint8_t, max_size()> keyData {};
+    encodeKey(k, keyData.data());
+
+    std::lock_guard lock(this->mutex);
+
+    switch (deleteFromRoot(keyData.data(), nullptr, &rowId)) {
+        case RecursiveDeleteResult::ENTRY_NOT_FOUND:
+            return ENTRY_DNE;
+        case RecursiveDeleteResult::KEY_NOT_FOUND:
+            return KEY_NOTFOUND;
+        default:
+            return SUCCESS;
+    }
+}
+
+void Tree::encodeKey(const Key *key, uint8_t *keyData) {
+    if (this->keyType == VARCHAR && options.leftAlignedVarchar) {
+        varcharToLeftAlignedByteArray(keyData, (const uint8_t*) key->keyval.charkey);
+    }
+    else {
+        prepareKeyData(key, keyData);
+    }
+}
+
+void Tree::decodeKey(const L1Item& l1Item, Key *key) {
+    key->type = keyType;
+
+    switch (keyType) {
+        case KeyType::SHORT:
+            key->keyval.shortkey = charArrayToInt32(l1Item.keyData.data());
+            break;
+        case KeyType::INT:
+            key->keyval.intkey = charArrayToInt64(l1Item.keyData.data());
+            break;
+        case KeyType::VARCHAR:
+            if (options.leftAlignedVarchar) {
+                leftAlignedByteArrayToVarchar(key->keyval.charkey, l1Item.keyData.data());
+            }
+            else {
+                byteArrayToVarchar(key->keyval.charkey, l1Item.keyData.data());
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+ErrCode Tree::insertRecord(TxnState *txn, Key *k, const char *payload) {
+    std::array<uint8_t, max_size()> keyData {};
+    encodeKey(k, keyData.data());
+
+    return insertEncoded(txn, keyData, payload);
+}
+
+ErrCode Tree::insertEncoded(TxnState *txn, const std::array<uint8_t, max_size()>& keyData, const char *payload) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    std::lock_guard lock(this->mutex);
+
+    auto transactionId = getTransactionId(txn);
+    return insertLocked(txn, transactionId, keyData, payload);
+}
+
+ErrCode Tree::insertLocked(TxnState *txn, uint32_t transactionId, const std::array<uint8_t, max_size()>& keyData, const char *payload) {
+    return insertIntoL1Item(txn, transactionId, findOrConstructL1Item(keyData), payload);
+}
+
+ErrCode Tree::insertIntoL1Item(TxnState *txn, uint32_t transactionId, offset l1Offset, const char *payload) {
+    auto l1Item = &accessL1Item(l1Offset);
+
+    if (options.internPayloads) {
+        // An id that is not interned yet can not be under this key either
+        uint32_t id = dictionary.find(payload);
+        auto& rowIds = accessRowIds(l1Offset);
+        for (const auto& item : rowIds) {
+            if (item.rowId == id) {
+                return ENTRY_EXISTS;
+            }
+        }
+
+        rowIds.push_back(RowIdItem {dictionary.acquire(payload), transactionId});
+        if (txn) {
+            this->transactionLogItems.emplace_back(transactionId, l1Offset, payload, true);
+        }
+        return SUCCESS;
+    }
+
+    for (const auto& l2 : l1Item->items) {
+        if (strcmp(l2.payload, payload) == 0) {
+            return ENTRY_EXISTS;
+        }
+    }
+
+    l1Item->items.emplace_back(L2Item (payload, transactionId));
+
+    if (txn) {
+        this->transactionLogItems.emplace_back(transactionId, l1Offset, payload, true);
+    }
+
+
+    return SUCCESS;
+}
+
+ErrCode Tree::updateRecord(TxnState *txn, Key *k, const char *oldPayload, const char *newPayload) {
+    std::array<uint8_t, max_size()> keyData {};
+    encodeKey(k, keyData.data());
+
+    return updateEncoded(txn, keyData, oldPayload, newPayload);
+}
+
+ErrCode Tree::updateEncoded(TxnState *txn, const std::array<uint8_t, max_size()>& keyData, const char *oldPayload, const char *newPayload) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    std::lock_guard lock(this->mutex);
+
+    auto transactionId = getTransactionId(txn);
+    auto l1Offset = findL1Item(keyData.data());
+    if (!isNodePresent(l1Offset)) {
+        return KEY_NOTFOUND;
+    }
+
+    return updateLocked(txn, transactionId, l1Offset, oldPayload, newPayload);
+}
+
+ErrCode Tree::upsertRecord(TxnState *txn, Key *k, const char *oldPayload, const char *newPayload) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    std::array<uint8_t, max_size()> keyData {};
+    encodeKey(k, keyData.data());
+
+    std::lock_guard lock(this->mutex);
+
+    auto transactionId = getTransactionId(txn);
+    auto l1Offset = findOrConstructL1Item(keyData);
+
+    auto result = updateLocked(txn, transactionId, l1Offset, oldPayload, newPayload);
+    if (result != ENTRY_DNE) {
+        return result;
+    }
+
+    return insertIntoL1Item(txn, transactionId, l1Offset, newPayload);
+}
+
+ErrCode Tree::updateLocked(TxnState *txn, uint32_t transactionId, offset l1Offset, const char *oldPayload, const char *newPayload) {
+    auto l1Item = &accessL1Item(l1Offset);
+
+    if (options.internPayloads) {
+        return updateInterned(txn, transactionId, l1Offset, oldPayload, newPayload);
+    }
+
+    auto target = l1Item->items.end();
+    bool newPayloadExists = false;
+    for (auto it = l1Item->items.begin(); it != l1Item->items.end(); it++) {
+        if (target == l1Item->items.end() && strcmp(it->payload, oldPayload) == 0 && isVisible(*it, transactionId)) {
+            target = it;
+        }
+        else if (strcmp(it->payload, newPayload) == 0) {
+            newPayloadExists = true;
+        }
+    }
+
+    if (target == l1Item->items.end()) {
+        return ENTRY_DNE;
+    }
+
+    if (newPayloadExists) {
+        return ENTRY_EXISTS;
+    }
+
+    // The entry keeps its place in the list, so cursors positioned on it stay valid
+    if (txn) {
+        this->transactionLogItems.emplace_back(transactionId, l1Offset, newPayload, target->payload, target->timestamp);
+    }
+
+    rewriteL2Item(l1Item->items, target, newPayload, transactionId);
+
+    return SUCCESS;
+}
+
+ErrCode Tree::updateInterned(TxnState *txn, uint32_t transactionId, offset l1Offset, const char *oldPayload, const char *newPayload) {
+    auto& rowIds = accessRowIds(l1Offset);
+    uint32_t oldId = dictionary.find(oldPayload);
+    uint32_t newId = dictionary.find(newPayload);
+
+    auto target = rowIds.end();
+    bool newPayloadExists = false;
+    for (auto it = rowIds.begin(); it != rowIds.end(); it++) {
+        if (target == rowIds.end() && it->rowId == oldId && isVisible(it->timestamp, transactionId)) {
+            target = it;
+        }
+        else if (it->rowId == newId) {
+            newPayloadExists = true;
+        }
+    }
+
+    if (target == rowIds.end()) {
+        return ENTRY_DNE;
+    }
+
+    if (newPayloadExists) {
+        return ENTRY_EXISTS;
+    }
+
+    if (txn) {
+        this->transactionLogItems.emplace_back(transactionId, l1Offset, newPayload, oldPayload, target->timestamp);
+    }
+
+    // Views of the old payload stay valid, its id is only reused once they are gone
+    target->rowId = dictionary.acquire(newPayload);
+    target->timestamp = transactionId;
+    dictionary.release(oldId, memDb->getEpochManager().retireEpoch());
+
+    return SUCCESS;
+}
+
+// Runs all tasks on up to `threads` threads, idle threads pick up the next unstarted task
+template<typename F>
+static void parallelFor(size_t tasks, unsigned threads, F f) {
+    std::atomic<size_t> next {0};
+    auto worker = [&]() {
+        for (size_t task = next++; task < tasks; task = next++) {
+            f(task);
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads && i < tasks; i++) {
+        pool.emplace_back(worker);
+    }
+    worker();
+
+    for (auto& t : pool) {
+        t.join();
+    }
+}
+
+// The 8 bits starting at the nibble of the given level
+static uint32_t partitionByte(const uint8_t* key, uint32_t level, uint32_t levels) {
+    uint32_t high = level < levels ? calculateIndex(key, level) : 0;
+    uint32_t low = level + 1 < levels ? calculateIndex(key, level + 1) : 0;
+    return high << 4 | low;
+}
+
+// Sort entry of a bulk load. The leading bytes of the encoded key as an integer decide most comparisons without
+// touching the key, the input position keeps the payloads of a key in input order.
+struct BulkLoadSortKey {
+    uint64_t leadingBytes;
+    uint32_t index;
+};
+
+static uint64_t leadingBytes(const uint8_t* key, size_t keySize) {
+    uint64_t bytes = 0;
+    memcpy(&bytes, key, std::min(keySize, sizeof(bytes)));
+    return __builtin_bswap64(bytes);
+}
+
+// Stable LSD radix sort by the leading bytes, scratch has room for count keys. Bytes all keys share take no pass.
+static void radixSort(BulkLoadSortKey* keys, BulkLoadSortKey* scratch, size_t count) {
+    BulkLoadSortKey* from = keys;
+    BulkLoadSortKey* to = scratch;
+    for (uint32_t shift = 0; shift < 64; shift += 8) {
+        std::array<size_t, 257> start {};
+        for (size_t i = 0; i < count; i++) {
+            start[(from[i].leadingBytes >> shift & 0xff) + 1]++;
+        }
+        if (std::find(start.begin(), start.end(), count) != start.end()) {
+            continue;
+        }
+
+        for (size_t digit = 1; digit <= 256; digit++) {
+            start[digit] += start[digit - 1];
+        }
+        for (size_t i = 0; i < count; i++) {
+            to[start[from[i].leadingBytes >> shift & 0xff]++] = from[i];
+        }
+        std::swap(from, to);
+    }
+
+    if (from != keys) {
+        std::copy(from, from + count, keys);
+    }
+}
+
+// Calls f(index, runBegin, runEnd) for every run of sorted keys sharing the same nibble at the given level
+template<typename F>
+static void forEachRun(uint32_t level, const BulkLoadInput& input, size_t first, size_t last, F f) {
+    size_t runBegin = first;
+    while (runBegin < last) {
+        auto index = calculateIndex(input.key(runBegin), level);
+        size_t runEnd = runBegin + 1;
+        while (runEnd < last && calculateIndex(input.key(runEnd), level) == index) {
+            runEnd++;
+        }
+
+        f(index, runBegin, runEnd);
+        runBegin = runEnd;
+    }
+}
+
+ErrCode Tree::bulkLoad(const Record *records, size_t count, unsigned threads) {
+    if (options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    BulkLoadInput input {};
+    input.keySize = SIZES[this->keyType];
+    input.records = records;
+    input.keys.resize(count * input.keySize);
+    input.order.resize(count);
+
+    // Dense keys share their leading nibbles (e.g. small integers, short right-aligned varchars), so the input is
+    // partitioned by the nibbles behind the prefix all keys have in common
+    const uint32_t levels = LEVELS[this->keyType];
+    uint32_t commonPrefix = levels;
+    std::vector<uint8_t> unsortedKeys(count * input.keySize);
+    std::vector<BulkLoadSortKey> sortKeys(count);
+    std::array<uint8_t, max_size()> keyData {};
+    for (size_t i = 0; i < count; i++) {
+        keyData.fill(0);
+        encodeKey(&records[i].key, keyData.data());
+        memcpy(unsortedKeys.data() + i * input.keySize, keyData.data(), input.keySize);
+        sortKeys[i] = BulkLoadSortKey {leadingBytes(keyData.data(), input.keySize), (uint32_t) i};
+        commonPrefix = std::min(commonPrefix, commonPrefixNibbles(unsortedKeys.data(), keyData.data(), input.keySize));
+    }
+    input.taskLevel = commonPrefix + BULK_LOAD_TASK_LEVELS;
+
+    const size_t keySize = input.keySize;
+    auto compareKeys = [&](const BulkLoadSortKey& a, const BulkLoadSortKey& b) {
+        if (a.leadingBytes != b.leadingBytes) {
+            return a.leadingBytes < b.leadingBytes;
+        }
+        if (keySize > sizeof(uint64_t)) {
+            int order = memcmp(unsortedKeys.data() + a.index * keySize + sizeof(uint64_t),
+                               unsortedKeys.data() + b.index * keySize + sizeof(uint64_t), keySize - sizeof(uint64_t));
+            if (order != 0) {
+                return order < 0;
+            }
+        }
+        return a.index < b.index;
+    };
+
+    // Presorted batches (e.g. nightly rebuilds from another index) skip the sort
+    if (!std::is_sorted(sortKeys.begin(), sortKeys.end(), compareKeys)) {
+        // Bucket by the byte behind the common prefix, the buckets are then sorted concurrently
+        auto bucketOf = [&](size_t i) {
+            return partitionByte(unsortedKeys.data() + i * keySize, commonPrefix, levels);
+        };
+
+        std::vector<size_t> bucketStart(257, 0);
+        for (size_t i = 0; i < count; i++) {
+            bucketStart[bucketOf(i) + 1]++;
+        }
+        for (size_t b = 1; b <= 256; b++) {
+            bucketStart[b] += bucketStart[b - 1];
+        }
+
+        std::vector<BulkLoadSortKey> scratch(count);
+        auto bucketNext = bucketStart;
+        for (size_t i = 0; i < count; i++) {
+            scratch[bucketNext[bucketOf(i)]++] = sortKeys[i];
+        }
+        sortKeys.swap(scratch);
+
+        // The input order of equal leading bytes survives the radix sort, only longer keys still compare their rest
+        parallelFor(256, threads, [&](size_t b) {
+            auto first = sortKeys.data() + bucketStart[b];
+            auto last = sortKeys.data() + bucketStart[b + 1];
+            radixSort(first, scratch.data() + bucketStart[b], last - first);
+
+            if (keySize > sizeof(uint64_t)) {
+                for (auto run = first; run != last;) {
+                    auto runEnd = std::find_if(run, last, [&](const BulkLoadSortKey& k) {
+                        return k.leadingBytes != run->leadingBytes;
+                    });
+                    std::sort(run, runEnd, compareKeys);
+                    run = runEnd;
+                }
+            }
+        });
+    }
+
+    // The leading bytes already hold short keys, only longer ones are gathered from the unsorted keys
+    const size_t leading = std::min(keySize, sizeof(uint64_t));
+    for (size_t i = 0; i < count; i++) {
+        uint64_t bytes = __builtin_bswap64(sortKeys[i].leadingBytes);
+        uint8_t* key = input.keys.data() + i * keySize;
+        memcpy(key, &bytes, leading);
+        if (keySize > leading) {
+            memcpy(key + leading, unsortedKeys.data() + sortKeys[i].index * keySize + leading, keySize - leading);
+        }
+        input.order[i] = sortKeys[i].index;
+    }
+    sortKeys = {};
+    unsortedKeys = {};
+
+    std::lock_guard lock(this->mutex);
+    input.transactionId = getTransactionId(nullptr);
+
+    // The dictionary is not shared between the loading threads, so interned payloads take the insert path as well
+    if (hasChildren(accessL0Item(rootElementOffset)) || options.internPayloads) {
+        // Merging into an existing trie takes the regular insert path, but only one latch acquisition
+        for (size_t i = 0; i < count; i++) {
+            keyData.fill(0);
+            memcpy(keyData.data(), input.key(i), input.keySize);
+            insertLocked(nullptr, input.transactionId, keyData, input.payload(i));
+        }
+
+        return SUCCESS;
+    }
+
+    // Every distinct key takes one L1 item, so neither the top levels nor the tasks reallocate the array
+    if (l1Items.size() + count > l1Items.capacity()) {
+        growL1Items(l1Items.size() + count);
+    }
+
+    // The top levels are built here, every subtree at the task level becomes a task
+    size_t firstL1Item = l1Items.size();
+    std::vector<BulkLoadTask> tasks;
+    bulkLoadTopLevels(rootElementOffset, 0, input, 0, count, tasks);
+    structureVersion++;
+    bulkLoadTasks = tasks.size();
+
+    // Largest subtrees first, so that the last tasks to be picked up are short ones
+    std::sort(tasks.begin(), tasks.end(), [](const BulkLoadTask& a, const BulkLoadTask& b) {
+        return a.last - a.first > b.last - b.first;
+    });
+
+    parallelFor(tasks.size(), threads, [&](size_t t) {
+        countBulkLoadNodes(tasks[t].level, input, tasks[t].first, tasks[t].last, tasks[t]);
+    });
+
+    // Every task writes its nodes into its own preassigned range of the arenas
+    size_t l0Count = l0Items.size();
+    size_t l1Count = l1Items.size();
+    for (auto& task : tasks) {
+        task.nextL0 = l0Count;
+        task.nextL1 = l1Count;
+        l0Count += task.l0Count;
+        l1Count += task.l1Count;
+    }
+
+    l0Items.resize(l0Count);
+    assert(l1Count <= l1Items.capacity());
+    l1Items.resize(l1Count, L1Item {std::array<uint8_t, max_size()> {}});
+
+    parallelFor(tasks.size(), threads, [&](size_t t) {
+        bulkLoadChildren(tasks[t].l0Offset, tasks[t].level, input, tasks[t].first, tasks[t].last, tasks[t]);
+    });
+
+    if (options.subtreeCounts) {
+        l0Counts.resize(l0Items.size());
+        countSubtree(rootElementOffset);
+    }
+
+    if (options.hashIndex) {
+        for (size_t i = firstL1Item; i < l1Items.size(); i++) {
+            hashIndex.insert(hashKey(l1Items[i].keyData.data()), getL1OffsetFromIndex(i));
+        }
+    }
+
+    if (options.keyFilter) {
+        rebuildKeyFilter(std::max(KEY_FILTER_INITIAL_KEYS, 2 * (l1Items.size() - firstL1Item)));
+    }
+
+    return SUCCESS;
+}
+
+void Tree::bulkLoadTopLevels(offset l0Offset, uint32_t level, const BulkLoadInput& input, size_t first, size_t last, std::vector<BulkLoadTask>& tasks) {
+    forEachRun(level, input, first, last, [&](uint32_t index, size_t runBegin, size_t runEnd) {
+        // Same shape as incremental inserts: an L1 sits at the first level where its key is unique
+        offset child;
+        if (memcmp(input.key(runBegin), input.key(runEnd - 1), input.keySize) == 0) {
+            child = getL1OffsetFromIndex(l1Items.size());
+            l1Items.emplace_back(L1Item {std::array<uint8_t, max_size()> {}});
+            fillBulkLoadL1Item(accessL1Item(child), input, runBegin, runEnd);
+        }
+        else {
+            child = markAsVisitable(l0Items.size());
+            l0Items.emplace_back(L0Item {});
+
+            if (level + 1 == input.taskLevel) {
+                BulkLoadTask task {};
+                task.l0Offset = child;
+                task.level = level + 1;
+                task.first = runBegin;
+                task.last = runEnd;
+                tasks.push_back(task);
+            }
+            else {
+                bulkLoadTopLevels(child, level + 1, input, runBegin, runEnd, tasks);
+            }
+        }
+
+        accessL0Item(l0Offset).children[index] = child;
+    });
+}
+
+void Tree::countBulkLoadNodes(uint32_t level, const BulkLoadInput& input, size_t first, size_t last, BulkLoadTask& task) {
+    forEachRun(level, input, first, last, [&](uint32_t, size_t runBegin, size_t runEnd) {
+        if (memcmp(input.key(runBegin), input.key(runEnd - 1), input.keySize) == 0) {
+            task.l1Count++;
+        }
+        else {
+            task.l0Count++;
+            countBulkLoadNodes(level + 1, input, runBegin, runEnd, task);
+        }
+    });
+}
+
+void Tree::bulkLoadChildren(offset l0Offset, uint32_t level, const BulkLoadInput& input, size_t first, size_t last, BulkLoadTask& task) {
+    forEachRun(level, input, first, last, [&](uint32_t index, size_t runBegin, size_t runEnd) {
+        offset child;
+        if (memcmp(input.key(runBegin), input.key(runEnd - 1), input.keySize) == 0) {
+            child = getL1OffsetFromIndex(task.nextL1++);
+            fillBulkLoadL1Item(accessL1Item(child), input, runBegin, runEnd);
+        }
+        else {
+            child = markAsVisitable(task.nextL0++);
+            bulkLoadChildren(child, level + 1, input, runBegin, runEnd, task);
+        }
+
+        accessL0Item(l0Offset).children[index] = child;
+    });
+}
+
+void Tree::fillBulkLoadL1Item(L1Item& l1Item, const BulkLoadInput& input, size_t first, size_t last) {
+    // Payloads are read in key order, which jumps around the records of an unsorted batch
+    if (last + BULK_LOAD_PREFETCH_DISTANCE < input.order.size()) {
+        const char* ahead = input.payload(last + BULK_LOAD_PREFETCH_DISTANCE);
+        __builtin_prefetch(ahead);
+        __builtin_prefetch(ahead + MAX_PAYLOAD_LEN);
+    }
+
+    memcpy(l1Item.keyData.data(), input.key(first), input.keySize);
+
+    for (size_t i = first; i < last; i++) {
+        bool exists = false;
+        for (const auto& l2 : l1Item.items) {
+            if (strcmp(l2.payload, input.payload(i)) == 0) {
+                exists = true;
+                break;
+            }
+        }
+
+        if (!exists) {
+            l1Item.items.emplace_back(L2Item (input.payload(i), input.transactionId));
+        }
+    }
+}
+
+ErrCode Tree::deleteRecord(TxnState *txn, Record *record) {
+    std::array<uint8_t, max_size()> keyData {};
+    encodeKey(&record->key, keyData.data());
+
+    char* payload = nullptr;
+    if (strnlen(record->payload, MAX_PAYLOAD_LEN)) {
+        payload = record->payload;
+    }
+
+    return deleteEncoded(txn, keyData, payload);
+}
+
+ErrCode Tree::deleteEncoded(TxnState *txn, const std::array<uint8_t, max_size()>& keyData, const char *payload) {
+    if (payload && options.rowIdPayloads) {
+        return FAILURE;
+    }
+
+    std::lock_guard lock(this->mutex);
+//    auto transactionId = getTransactionId(txn, db);
+
+    auto result = deleteFromRoot(keyData.data(), payload);
+    switch (result) {
+        case RecursiveDeleteResult::ENTRY_NOT_FOUND:
+            return ENTRY_DNE;
+        case RecursiveDeleteResult::KEY_NOT_FOUND:
+            return KEY_NOTFOUND;
+        default:
+            return SUCCESS;
+    }
+}
+
+ErrCode Tree::deleteRange(const KeyRange *range, size_t *deleted) {
+    RangeDelete del {};
+    del.keySize = SIZES[this->keyType];
+    del.lowBounded = range->lowType != UNBOUNDED;
+    del.lowInclusive = range->lowType == INCLUSIVE;
+    if (del.lowBounded) {
+        encodeKey(&range->low, del.low.data());
+    }
+    del.highBounded = range->highType != UNBOUNDED;
+    del.highInclusive = range->highType == INCLUSIVE;
+    if (del.highBounded) {
+        encodeKey(&range->high, del.high.data());
+    }
+
+    std::lock_guard lock(this->mutex);
+
+    size_t deletedKeys = 0;
+    if (!del.lowBounded || !del.highBounded || memcmp(del.low.data(), del.high.data(), del.keySize) <= 0) {
+        deletedKeys = deleteRangeBelow(rootElementOffset, 0, del.lowBounded, del.highBounded, del);
+    }
+
+    if (options.subtreeCounts) {
+        subtreeCount(rootElementOffset) -= deletedKeys;
+    }
+    releaseDetachedItems(del);
+
+    if (deleted) {
+        *deleted = del.deletedRecords;
+    }
+    return SUCCESS;
+}
+
+// A tight side means the path to l0Offset equals the prefix of that bound, only then the bound cuts off children
+size_t Tree::deleteRangeBelow(offset l0Offset, uint32_t level, bool lowTight, bool highTight, RangeDelete& del) {
+    size_t first = lowTight ? calculateIndex(del.low.data(), level) : 0;
+    size_t last = highTight ? calculateIndex(del.high.data(), level) : 15;
+    size_t deletedKeys = 0;
+
+    for (size_t index = first; index <= last; index++) {
+        offset child = accessL0Item(l0Offset).children[index];
+        if (!isNodeVisitable(child)) {
+            continue;
+        }
+
+        if (isL1Node(child)) {
+            if (del.contains(accessL1Item(child).keyData.data())) {
+                accessL0Item(l0Offset).children[index] = NO_CHILD;
+                deletedKeys += releaseSubtree(child, del);
+            }
+            continue;
+        }
+
+        bool childLowTight = lowTight && index == first;
+        bool childHighTight = highTight && index == last;
+
+        // The whole key span of the child lies within the range, it is detached without looking at its keys
+        if (!childLowTight && !childHighTight) {
+            accessL0Item(l0Offset).children[index] = NO_CHILD;
+            deletedKeys += releaseSubtree(child, del);
+            continue;
+        }
+
+        size_t deletedBelow = deleteRangeBelow(child, level + 1, childLowTight, childHighTight, del);
+        if (deletedBelow == 0) {
+            continue;
+        }
+        deletedKeys += deletedBelow;
+
+        // Like recursiveDelete, drop emptied nodes and pull a remaining single L1 item up
+        L0Item& next = accessL0Item(child);
+        offset l1Offset = singleL1Child(next);
+        if (!hasChildren(next)) {
+            accessL0Item(l0Offset).children[index] = NO_CHILD;
+            del.releasedL0Items.push_back(child);
+        }
+        else if (isNodePresent(l1Offset)) {
+            accessL0Item(l0Offset).children[index] = l1Offset;
+            del.releasedL0Items.push_back(child);
+        }
+        else if (options.subtreeCounts) {
+            subtreeCount(child) -= deletedBelow;
+        }
+    }
+
+    return deletedKeys;
+}
+
+// Returns the number of keys below child
+size_t Tree::releaseSubtree(offset child, RangeDelete& del) {
+    if (isL1Node(child)) {
+        del.releasedL1Items.push_back(child);
+        del.deletedRecords += hasIdPayloads() ? accessRowIds(child).size() : accessL1Item(child).items.size();
+        return 1;
+    }
+
+    size_t keys = 0;
+    del.releasedL0Items.push_back(child);
+    for (auto grandChild : accessL0Item(child).children) {
+        if (isNodeVisitable(grandChild)) {
+            keys += releaseSubtree(grandChild, del);
+        }
+    }
+    return keys;
+}
+
+// Same as releasing the items one by one, but purges the log and the cursors in a single pass
+void Tree::releaseDetachedItems(RangeDelete& del) {
+    if (del.releasedL0Items.empty() && del.releasedL1Items.empty()) {
+        return;
+    }
+
+    structureVersion++;
+
+    auto& released = del.releasedL1Items;
+    std::sort(released.begin(), released.end());
+    auto isReleased = [&](offset l1Offset) {
+        return std::binary_search(released.begin(), released.end(), l1Offset);
+    };
+
+    eraseLogItems([&](const auto& t) {
+        return isReleased(t.l1Offset);
+    });
+
+    for (auto& readPosition : readPositions) {
+        if (isReleased(readPosition.second.l1Offset)) {
+            readPosition.second.hasMoreL2Items = false;
+        }
+    }
+
+    auto epoch = memDb->getEpochManager().retireEpoch();
+    for (auto l0Offset : del.releasedL0Items) {
+        retiredL0Items.retire(l0Offset, epoch);
+    }
+    for (auto l1Offset : released) {
+        forgetL1Item(l1Offset);
+        retiredL1Items.retire(l1Offset, epoch);
+    }
+}
+
+void Tree::truncate() {
+    struct Arenas {
+        std::vector<L0Item> l0Items;
+        std::vector<uint32_t> l0Counts;
+        std::vector<L1Item> l1Items;
+        std::vector<std::vector<RowIdItem>> l1RowIds;
+        PayloadDictionary dictionary;
+    };
+    auto old = std::make_shared<Arenas>();
+
+    std::lock_guard lock(this->mutex);
+
+    old->l0Items.swap(l0Items);
+    old->l0Counts.swap(l0Counts);
+    old->l1Items.swap(l1Items);
+    old->l1RowIds.swap(l1RowIds);
+    std::swap(old->dictionary, dictionary);
+    initArenas();
+
+    // Nothing in the old arenas can be reused or rolled back anymore
+    freeL0Items.clear();
+    freeL1Items.clear();
+    retiredL0Items.clear();
+    retiredL1Items.clear();
+    std::fill(hotKeys.begin(), hotKeys.end(), NO_CHILD);
+    hashIndex.clear();
+    transactionLogItems.clear();
+    rowIdLogItems.clear();
+    for (auto& readPosition : readPositions) {
+        readPosition.second = ReadPosition {};
+    }
+    structureVersion++;
+
+    // Lock-free readers may still walk the old arenas, their payloads are freed once they left
+    memDb->getEpochManager().retire([old]() {
+        *old = Arenas {};
+    });
+}
+
+RecursiveDeleteResult Tree::deleteFromRoot(const uint8_t *keyData, const char* payload, const uint64_t* rowId) {
+    // An interned payload is deleted by its id
+    uint64_t payloadId = 0;
+    if (payload && options.internPayloads) {
+        payloadId = dictionary.find(payload);
+        payload = nullptr;
+        rowId = &payloadId;
+    }
+
+    auto result = recursiveDelete(0, &accessL0Item(rootElementOffset), keyData, payload, rowId);
+
+    // The root is never released, the recursion only maintains the counts below it
+    if (options.subtreeCounts && (result == RecursiveDeleteResult::KEY_DELETED || result == RecursiveDeleteResult::ALL_DELETED)) {
+        subtreeCount(rootElementOffset)--;
+    }
+
+    return result;
+}
+
+RecursiveDeleteResult Tree::recursiveDelete(uint32_t level, L0Item* l0Item, const uint8_t *keyData, const char* payload, const uint64_t* rowId) {
+    if (level == LEVELS[this->keyType]) {
+        assert(false);
+    }
+
+    offset index = calculateIndex(keyData, level);
+    offset child = l0Item->children[index];
+
+    if (!isNodeVisitable(child)) {
+        return RecursiveDeleteResult::KEY_NOT_FOUND;
+    }
+
+    if (isL1Node(child)) {
+        auto l1Item = &accessL1Item(child);
+
+        // The slot may be occupied by a different key sharing our prefix
+        if (memcmp(l1Item->keyData.data(), keyData, SIZES[this->keyType]) != 0) {
+            return RecursiveDeleteResult::KEY_NOT_FOUND;
+        }
+
+        if (payload) {
+            auto it = l1Item->items.begin();
+            for (; it != l1Item->items.end(); it++) {
+                if (strcmp(it->payload, payload) == 0) {
+                    break;
+                }
+            }
+
+            if (it == l1Item->items.end()) {
+                return RecursiveDeleteResult::ENTRY_NOT_FOUND;
+            }
+
+            for (auto& readPosition : readPositions) {
+                if (readPosition.second.l1Offset == child && readPosition.second.l2Iterator == it) {
+                    readPosition.second.l2Iterator = ++readPosition.second.l2Iterator;
+                }
+            }
+
+            retireL2Item(l1Item->items, it);
+            if (!l1Item->items.empty()) {
+                return RecursiveDeleteResult::ONE_DELETED;
+            }
+        }
+
+        if (rowId) {
+            auto& rowIds = accessRowIds(child);
+            size_t i = 0;
+            while (i < rowIds.size() && rowIds[i].rowId != *rowId) {
+                i++;
+            }
+
+            if (i == rowIds.size()) {
+                return RecursiveDeleteResult::ENTRY_NOT_FOUND;
+            }
+
+            // Cursors behind the erased row id move along with the ones after it
+            for (auto& readPosition : readPositions) {
+                if (readPosition.second.l1Offset == child && readPosition.second.rowIdIndex > i) {
+                    readPosition.second.rowIdIndex--;
+                }
+            }
+
+            if (options.internPayloads) {
+                dictionary.release(rowIds[i].rowId, memDb->getEpochManager().retireEpoch());
+            }
+            rowIds.erase(rowIds.begin() + i);
+            if (!rowIds.empty()) {
+                return RecursiveDeleteResult::ONE_DELETED;
+            }
+        }
+
+        for (auto& readPosition : readPositions) {
+            if (readPosition.second.l1Offset == child) {
+                readPosition.second.hasMoreL2Items = false;
+            }
+        }
+
+        l0Item->children[index] = NO_CHILD;
+        releaseL1Item(child);
+        return hasChildren(*l0Item) ? RecursiveDeleteResult::KEY_DELETED : RecursiveDeleteResult::ALL_DELETED;
+    }
+
+    L0Item* next = &accessL0Item(child);
+    auto result = recursiveDelete(level + 1, next, keyData, payload, rowId);
+
+    switch (result) {
+        case RecursiveDeleteResult::ALL_DELETED: {
+            l0Item->children[index] = NO_CHILD;
+            releaseL0Item(child);
+
+            return hasChildren(*l0Item) ? RecursiveDeleteResult::KEY_DELETED : RecursiveDeleteResult::ALL_DELETED;
+        }
+
+        case RecursiveDeleteResult::KEY_DELETED: {
+            // Restore the compact form findOrConstructL1Item had before splitting the L1 into a chain
+            offset l1Offset = singleL1Child(*next);
+            if (isNodePresent(l1Offset)) {
+                l0Item->children[index] = l1Offset;
+                releaseL0Item(child);
+            }
+            else if (options.subtreeCounts) {
+                subtreeCount(child)--;
+            }
+
+            return result;
+        }
+
+        case RecursiveDeleteResult::ONE_DELETED:
         case RecursiveDeleteResult::ENTRY_NOT_FOUND:
         case RecursiveDeleteResult::KEY_NOT_FOUND:
             return result;
+    }
+
+    return result;
+}
+
+
+void Tree::commit(uint32_t transactionId) {
+    std::lock_guard lock(mutex);
+
+    removeTransaction(transactionId);
+}
+
+void Tree::removeTransaction(uint32_t transactionId) {
+    auto it = readPositions.find(transactionId);
+    if (it != readPositions.end()) {
+        readPositions.erase(it);
+
+        eraseLogItems([=](const auto& t) {
+            return t.transactionId == transactionId;
+        });
+    }
+}
+
+void Tree::abort(uint32_t transactionId) {
+    std::lock_guard lock(this->mutex);
+
+    // The entries of the transaction are taken out of the logs in one pass, in their original order
+    auto isOther = [=](const auto& t) {
+        return t.transactionId != transactionId;
+    };
+    auto split = std::stable_partition(transactionLogItems.begin(), transactionLogItems.end(), isOther);
+    std::vector<TransactionLogItem> undo(std::make_move_iterator(split), std::make_move_iterator(transactionLogItems.end()));
+    transactionLogItems.erase(split, transactionLogItems.end());
+
+    auto rowIdSplit = std::stable_partition(rowIdLogItems.begin(), rowIdLogItems.end(), isOther);
+    std::vector<RowIdLogItem> rowIdUndo(rowIdSplit, rowIdLogItems.end());
+    rowIdLogItems.erase(rowIdSplit, rowIdLogItems.end());
+
+    // Slots the undo releases are purged from the logs once at the end. The undo allocates nothing, so no slot is
+    // reused before that, and entries of a released slot find nothing left to undo.
+    deferLogPurges = true;
+
+    // Newest first, so that an update of an entry created in the same transaction is reverted before the entry is deleted
+    for (auto t = undo.rbegin(); t != undo.rend(); t++) {
+        auto l1Item = &accessL1Item(t->l1Offset);
+        if (t->created) {
+            auto keyData = l1Item->keyData;
+            deleteFromRoot(keyData.data(), t->payload);
+            continue;
+        }
+
+        if (options.internPayloads) {
+            uint32_t id = dictionary.find(t->payload);
+            for (auto& item : accessRowIds(t->l1Offset)) {
+                if (item.rowId == id) {
+                    item.rowId = dictionary.acquire(t->before->payload);
+                    item.timestamp = t->before->timestamp;
+                    dictionary.release(id, memDb->getEpochManager().retireEpoch());
+                    break;
+                }
+            }
+            continue;
+        }
+
+        for (auto it = l1Item->items.begin(); it != l1Item->items.end(); it++) {
+            if (strcmp(it->payload, t->payload) == 0) {
+                rewriteL2Item(l1Item->items, it, t->before->payload, t->before->timestamp);
+                break;
+            }
+        }
+    }
+
+    // An index with row id payloads only logs the inserts of row ids
+    for (auto t = rowIdUndo.rbegin(); t != rowIdUndo.rend(); t++) {
+        auto keyData = accessL1Item(t->l1Offset).keyData;
+        deleteFromRoot(keyData.data(), nullptr, &t->rowId);
+    }
+
+    deferLogPurges = false;
+    auto& released = deferredLogPurges;
+    if (!released.empty()) {
+        std::sort(released.begin(), released.end());
+        eraseLogItems([&](const auto& t) {
+            return std::binary_search(released.begin(), released.end(), t.l1Offset);
+        });
+        released.clear();
+    }
+
+    removeTransaction(transactionId);
+}
+
+offset Tree::findL1Item(const uint8_t *data, LookupFinger *finger) {
+    if (!options.keyFilter && !options.hashIndex && hotKeys.empty()) {
+        return findL1ItemInTrie(data, finger);
+    }
+
+    auto hash = hashKey(data);
+    if (options.keyFilter && !keyFilter.mayContain(hash)) {
+        keyFilterRejections++;
+        return NO_CHILD;
+    }
+
+    if (options.hashIndex) {
+        return hashIndex.find(hash, [&](offset l1Offset) {
+            return memcmp(data, accessL1Item(l1Offset).keyData.data(), SIZES[this->keyType]) == 0;
+        });
+    }
+
+    if (hotKeys.empty()) {
+        return findL1ItemInTrie(data, finger);
+    }
 
+    // Cached offsets always belong to live L1 items, so the key comparison is the only check
+    auto& slot = hotKeys[hash & (hotKeys.size() - 1)];
+    if (isL1Node(slot) && memcmp(data, accessL1Item(slot).keyData.data(), SIZES[this->keyType]) == 0) {
+        hotKeyHits++;
+        return slot;
     }
+
+    hotKeyMisses++;
+    auto l1Offset = findL1ItemInTrie(data, finger);
+    if (isL1Node(l1Offset)) {
+        slot = l1Offset;
+    }
+    return l1Offset;
 }
 
+size_t Tree::hashKey(const uint8_t *data) {
+    return std::hash<std::string_view> {}(std::string_view((const char*) data, SIZES[this->keyType]));
+}
 
-void Tree::commit(uint32_t transactionId) {
-    std::lock_guard lock(mutex);
+// Drops a released L1 item from the lookup structures next to the trie
+void Tree::forgetL1Item(offset l1Offset) {
+    if (!options.keyFilter && !options.hashIndex && hotKeys.empty()) {
+        return;
+    }
 
-    removeTransaction(transactionId);
-}
+    auto hash = hashKey(accessL1Item(l1Offset).keyData.data());
+    if (options.keyFilter) {
+        keyFilter.remove(hash);
+    }
 
-void Tree::removeTransaction(uint32_t transactionId) {
-    auto it = readPositions.find(transactionId);
-    if (it != readPositions.end()) {
-        readPositions.erase(it);
+    if (options.hashIndex) {
+        hashIndex.erase(hash, l1Offset);
+    }
 
-        auto end = std::remove_if(transactionLogItems.begin(), transactionLogItems.end(), [=](const TransactionLogItem& t) {
-            return t.transactionId == transactionId;
-        });
+    if (hotKeys.empty()) {
+        return;
+    }
 
-        transactionLogItems.erase(end, transactionLogItems.end());
+    auto& slot = hotKeys[hash & (hotKeys.size() - 1)];
+    if (slot == l1Offset) {
+        slot = NO_CHILD;
     }
 }
 
-void Tree::abort(uint32_t transactionId) {
-    std::lock_guard lock(this->mutex);
+// Sizes the filter for the given number of keys and adds all live keys again
+void Tree::rebuildKeyFilter(size_t keys) {
+    keyFilter.reset(keys);
 
-    for (const auto& t : transactionLogItems) {
-        if (t.transactionId == transactionId && t.created) {
-            auto l1Item = &accessL1Item(t.l1Offset);
+    // A sequential pass over the arena is much cheaper than a walk of the trie, the free and retired items are
+    // skipped. The first item is the placeholder of initArenas.
+    std::vector<bool> released(l1Items.size(), false);
+    released[0] = true;
+    for (auto l1Offset : freeL1Items) {
+        released[getL1IndexFromOffset(l1Offset)] = true;
+    }
+    retiredL1Items.forEach([&](offset l1Offset) {
+        released[getL1IndexFromOffset(l1Offset)] = true;
+    });
 
-            for (auto it = l1Item->items.begin(); it != l1Item->items.end(); it++) {
-                if (strcmp(it->payload, t.payload) == 0) {
-                    l1Item->items.erase(it);
-                    break;
-                }
-            }
+    for (size_t i = 0; i < l1Items.size(); i++) {
+        if (!released[i]) {
+            keyFilter.add(hashKey(l1Items[i].keyData.data()));
         }
     }
-
-    removeTransaction(transactionId);
 }
 
-offset Tree::findL1Item(const uint8_t *data, TxnState* txn) {
+offset Tree::findL1ItemInTrie(const uint8_t *data, LookupFinger *finger) {
+    if (finger) {
+        return findL1ItemFromFinger(data, *finger);
+    }
+
     auto currentL0Item = &accessL0Item(rootElementOffset);
 
     for (size_t level = 0; level < LEVELS[this->keyType] / 2; level++) {
         auto indices = calculateNextTwoIndices(data, level);
 
         offset i = currentL0Item->children[indices.first];
-        if (txn) {
-            txn->traversalTrace[2*level] = indices.first;
-        }
         if (isL1Node(i)) {
             if (memcmp(data, &accessL1Item(i), SIZES[this->keyType]) == 0) {
-                if (txn) {
-                    txn->traversalTrace[level * 2]++;
-                }
                 return i;
             }
             else {
@@ -383,14 +2004,8 @@ offset Tree::findL1Item(const uint8_t *data, TxnState* txn) {
         currentL0Item = &accessL0Item(i);
 
         i = currentL0Item->children[indices.second];
-        if (txn) {
-            txn->traversalTrace[2 * level + 1] = indices.second;
-        }
         if (isL1Node(i)) {
             if (memcmp(data, &accessL1Item(i), SIZES[this->keyType]) == 0) {
-                if (txn) {
-                    txn->traversalTrace[level * 2 + 1]++;
-                }
                 return i;
             }
             else {
@@ -407,6 +2022,37 @@ offset Tree::findL1Item(const uint8_t *data, TxnState* txn) {
     return NO_CHILD;
 }
 
+offset Tree::findL1ItemFromFinger(const uint8_t *data, LookupFinger& finger) {
+    const size_t keySize = SIZES[this->keyType];
+
+    // The L0 item at a level is the same for all keys sharing that many leading nibbles
+    uint32_t level = 0;
+    if (finger.depth > 0 && finger.version == structureVersion) {
+        level = std::min(commonPrefixNibbles(data, finger.keyData.data(), keySize), finger.depth - 1);
+    }
+    else {
+        finger.path[0] = rootElementOffset;
+    }
+
+    finger.version = structureVersion;
+    memcpy(finger.keyData.data(), data, keySize);
+
+    while (true) {
+        offset child = accessL0Item(finger.path[level]).children[calculateIndex(data, level)];
+        finger.depth = level + 1;
+
+        if (isL1Node(child)) {
+            return memcmp(data, accessL1Item(child).keyData.data(), keySize) == 0 ? child : NO_CHILD;
+        }
+
+        if (!isNodeVisitable(child)) {
+            return NO_CHILD;
+        }
+
+        finger.path[++level] = child;
+    }
+}
+
 offset Tree::findL1ItemWithSmallestKey() {
     L0Item* current = &accessL0Item(rootElementOffset);
 
@@ -436,18 +2082,110 @@ offset Tree::findL1ItemWithSmallestKey() {
     return NO_CHILD;
 }
 
+// Keeps the right edge valid across the insert of a new key, edgeValid tells whether it was valid before
+void Tree::trackRightEdge(const std::array<uint8_t, max_size()>& keyData, const std::array<offset, max_levels()>& path, size_t depth,
+                          offset l1Offset, offset splitL1, bool edgeValid) {
+    int cmp = memcmp(keyData.data(), rightEdge.keyData.data(), SIZES[this->keyType]);
+
+    // Smaller keys only add nodes to the right edge when they split the largest L1 item off its slot
+    if (edgeValid && cmp < 0 && splitL1 != rightEdge.l1Offset) {
+        rightEdge.version = structureVersion;
+        return;
+    }
+
+    if ((edgeValid && cmp > 0) || isOnRightEdge(keyData.data(), path, depth)) {
+        std::copy(path.begin(), path.begin() + depth, rightEdge.path.begin());
+        rightEdge.depth = depth;
+        rightEdge.keyData = keyData;
+        rightEdge.l1Offset = l1Offset;
+        rightEdge.version = structureVersion;
+    }
+    else {
+        rightEdge.depth = 0;
+    }
+}
+
+// Whether no key of the trie is right of the given path
+bool Tree::isOnRightEdge(const uint8_t *keyData, const std::array<offset, max_levels()>& path, size_t depth) {
+    for (size_t level = 0; level < depth; level++) {
+        const auto& children = accessL0Item(path[level]).children;
+        for (auto index = calculateIndex(keyData, level) + 1; index < 16; index++) {
+            if (isNodePresent(children[index])) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+offset Tree::findL1ItemWithLargestKey() {
+    // Only nodes being allocated or released can change the largest key
+    if (largestL1ItemVersion == structureVersion) {
+        return largestL1Item;
+    }
+
+    L0Item* current = &accessL0Item(rootElementOffset);
+    offset result = NO_CHILD;
+
+    for (size_t level = 0; level < LEVELS[this->keyType] && result == NO_CHILD; level++) {
+        bool found = false;
+
+        for (int i = 15; i >= 0; i--) {
+            offset idx = current->children[i];
+            if (isL1Node(idx)) {
+                result = idx;
+                break;
+            }
+
+            if (isNodeVisitable(idx)) {
+                current = &accessL0Item(idx);
+                found = true;
+
+                break;
+            }
+        }
+
+        if (!found) {
+            break;
+        }
+    }
+
+    largestL1Item = result;
+    largestL1ItemVersion = structureVersion;
+    return result;
+}
+
 offset Tree::findOrConstructL1Item(const std::array<uint8_t, max_size()>& keyData) {
-    auto currentL0Item = &accessL0Item(rootElementOffset);
+    const size_t keySize = SIZES[this->keyType];
+
+    // Allocations may grow l0Items, so we only keep offsets across them
+    offset currentOffset = rootElementOffset;
+
+    // The existing L0 items above a new key, their subtree counts grow by one. Further down, the new chain of a split.
+    std::array<offset, max_levels()> path;
+
+    // A key past the largest one shares the right edge of the trie down to their common prefix, the traversal
+    // starts at the end of that
+    size_t startLevel = 0;
+    bool edgeValid = rightEdge.depth > 0 && rightEdge.version == structureVersion;
+    if (edgeValid && memcmp(keyData.data(), rightEdge.keyData.data(), keySize) > 0) {
+        startLevel = std::min<size_t>(commonPrefixNibbles(keyData.data(), rightEdge.keyData.data(), keySize), rightEdge.depth - 1);
+        std::copy(rightEdge.path.begin(), rightEdge.path.begin() + startLevel, path.begin());
+        currentOffset = rightEdge.path[startLevel];
+    }
 
-    for (size_t level = 0; level < LEVELS[this->keyType]; level++) {
+    for (size_t level = startLevel; level < LEVELS[this->keyType]; level++) {
+        path[level] = currentOffset;
         auto index = calculateIndex(keyData.data(), level);
-        offset i = currentL0Item->children[index];
+        offset i = accessL0Item(currentOffset).children[index];
 
         if (!isNodePresent(i)) {
             // We have found an empty slot, we can construct L1 directly
-            offset l1Offset = getL1OffsetFromIndex(l1Items.size());
-            l1Items.emplace_back(L1Item {keyData});
-            currentL0Item->children[index] = l1Offset;
+            offset l1Offset = allocateL1Item(keyData);
+            accessL0Item(currentOffset).children[index] = l1Offset;
+            addKeyToSubtreeCounts(path, level + 1);
+            trackRightEdge(keyData, path, level + 1, l1Offset, NO_CHILD, edgeValid);
             return l1Offset;
         }
 
@@ -463,88 +2201,543 @@ offset Tree::findOrConstructL1Item(const std::array<uint8_t, max_size()>& keyDat
             else {
                 // We do not share the same key, so we save the old l1Offset and construct a new L0Item
                 offset oldL1 = i;
+                addKeyToSubtreeCounts(path, level + 1);
 
-                auto newL0Offset = markAsVisitable(l0Items.size());
-                currentL0Item->children[index] = newL0Offset;
-                l0Items.emplace_back(L0Item ());
-                currentL0Item = &accessL0Item(newL0Offset);
+                // Every L0 item of the new chain holds exactly the old and the new key
+                auto newL0Offset = allocateL0Item();
+                setSubtreeCount(newL0Offset, 2);
+                accessL0Item(currentOffset).children[index] = newL0Offset;
+                currentOffset = newL0Offset;
 
-                for (size_t nestedLevel = level + 1; level < LEVELS[this->keyType]; nestedLevel++) {
+                for (size_t nestedLevel = level + 1; nestedLevel < LEVELS[this->keyType]; nestedLevel++) {
+                    path[nestedLevel] = currentOffset;
                     auto newL1Index = calculateIndex(keyData.data(), nestedLevel);
                     auto oldL1Index = calculateIndex(accessL1Item(oldL1).keyData.data(), nestedLevel);
 
                     if (newL1Index == oldL1Index) {
-                        newL0Offset = markAsVisitable(l0Items.size());
-                        currentL0Item->children[newL1Index] = newL0Offset;
-                        l0Items.emplace_back(L0Item ());
-                        currentL0Item = &accessL0Item(newL0Offset);
+                        newL0Offset = allocateL0Item();
+                        setSubtreeCount(newL0Offset, 2);
+                        accessL0Item(currentOffset).children[newL1Index] = newL0Offset;
+                        currentOffset = newL0Offset;
                     }
                     else {
+                        offset l1Offset = allocateL1Item(keyData);
+                        auto currentL0Item = &accessL0Item(currentOffset);
                         currentL0Item->children[oldL1Index] = oldL1;
-                        offset l1Offset = getL1OffsetFromIndex(l1Items.size());
-                        l1Items.emplace_back(L1Item {keyData});
                         currentL0Item->children[newL1Index] = l1Offset;
+                        trackRightEdge(keyData, path, nestedLevel + 1, l1Offset, oldL1, edgeValid);
                         return l1Offset;
                     }
                 }
 
+                return NO_CHILD;
             }
         }
         else {
+            auto currentL0Item = &accessL0Item(currentOffset);
             currentL0Item->children[index] = markAsVisitable(currentL0Item->children[index]);
-            currentL0Item = &accessL0Item(currentL0Item->children[index]);
+            currentOffset = currentL0Item->children[index];
         }
     }
 
     return NO_CHILD;
 }
 
-offset Tree::recursiveFindL1(TxnState* txn, uint32_t level, L0Item* l0Item, uint32_t* indexUpdate) {
+offset Tree::allocateL0Item() {
+    if (freeL0Items.empty()) {
+        collectRetiredItems();
+    }
+
+    if (!freeL0Items.empty()) {
+        offset l0Offset = freeL0Items.back();
+        freeL0Items.pop_back();
+        accessL0Item(l0Offset) = L0Item {};
+        setSubtreeCount(l0Offset, 0);
+        return l0Offset;
+    }
 
-    int initial = 0;
-    if (txn) {
-        initial = txn->traversalTrace[level];
+    offset l0Offset = markAsVisitable(l0Items.size());
+    l0Items.emplace_back(L0Item {});
+    if (options.subtreeCounts) {
+        l0Counts.emplace_back(0);
+    }
+    return l0Offset;
+}
+
+offset Tree::allocateL1Item(const std::array<uint8_t, max_size()>& keyData) {
+    // Every change of the trie structure allocates or releases a node
+    structureVersion++;
+
+    if (freeL1Items.empty()) {
+        collectRetiredItems();
+    }
+
+    // Before the allocation, so that the rebuild does not see the new item yet
+    if (options.keyFilter && keyFilter.full()) {
+        rebuildKeyFilter(keyFilter.capacity() * 2);
+    }
+
+    offset l1Offset;
+    if (!freeL1Items.empty()) {
+        l1Offset = freeL1Items.back();
+        freeL1Items.pop_back();
+        accessL1Item(l1Offset).keyData = keyData;
+    }
+    else {
+        if (l1Items.size() == l1Items.capacity()) {
+            growL1Items(l1Items.size() + 1);
+        }
+
+        l1Offset = getL1OffsetFromIndex(l1Items.size());
+        l1Items.emplace_back(L1Item {keyData});
+        if (hasIdPayloads()) {
+            l1RowIds.emplace_back();
+        }
+    }
+
+    if (options.hashIndex) {
+        hashIndex.insert(hashKey(keyData.data()), l1Offset);
+    }
+
+    if (options.keyFilter) {
+        keyFilter.add(hashKey(keyData.data()));
+    }
+    return l1Offset;
+}
+
+void Tree::growL1Items(size_t capacity) {
+    // Views point at the keys of L1 items, so the old array is retired instead of being freed by the reallocation.
+    // Moving the items keeps their payload lists in place.
+    auto old = std::make_shared<std::vector<L1Item>>();
+    old->reserve(std::max(l1Items.capacity() * 2, capacity));
+    std::move(l1Items.begin(), l1Items.end(), std::back_inserter(*old));
+    std::swap(l1Items, *old);
+
+    memDb->getEpochManager().retire([old]() {
+        old->clear();
+        old->shrink_to_fit();
+    });
+}
+
+void Tree::releaseL0Item(offset l0Offset) {
+    structureVersion++;
+    retiredL0Items.retire(l0Offset, memDb->getEpochManager().retireEpoch());
+}
+
+void Tree::releaseL1Item(offset l1Offset) {
+    structureVersion++;
+
+    // Pending undo entries of this slot have nothing left to roll back,
+    // and must not match whatever key reuses the slot later on.
+    if (deferLogPurges) {
+        deferredLogPurges.push_back(l1Offset);
+    }
+    else {
+        eraseLogItems([=](const auto& t) {
+            return t.l1Offset == l1Offset;
+        });
+    }
+
+    forgetL1Item(l1Offset);
+    retiredL1Items.retire(l1Offset, memDb->getEpochManager().retireEpoch());
+}
+
+void Tree::rewriteL2Item(std::list<L2Item>& items, std::list<L2Item>::iterator it, const char *payload, uint32_t timestamp) {
+    if (activeReadGuards.load() == 0) {
+        strcpy(it->payload, payload);
+        it->timestamp = timestamp;
+        return;
     }
 
-    for (int i = initial; i < 16; i++) {
-        if (isL1Node(l0Item->children[i])) {
+    // A view may point at the entry, so the new version takes over its place and the old one is retired
+    auto copy = items.emplace(it, L2Item (payload, timestamp));
+    for (auto& readPosition : readPositions) {
+        if (readPosition.second.hasMoreL2Items && readPosition.second.l2Iterator == it) {
+            readPosition.second.l2Iterator = copy;
+        }
+    }
+    retireL2Item(items, it);
+}
+
+void Tree::retireL2Item(std::list<L2Item>& items, std::list<L2Item>::iterator it) {
+    // Unlinked entries stay allocated until no view can point at them anymore
+    std::list<L2Item> retired;
+    retired.splice(retired.end(), items, it);
+
+    auto& epochManager = memDb->getEpochManager();
+    retiredL2Items.retire(std::move(retired), epochManager.retireEpoch());
+    if (retiredL2Items.size() >= L2_RETIRE_BATCH) {
+        retiredL2Items.collect(epochManager.safeEpoch(), [](std::list<L2Item>&) {});
+    }
+}
+
+void Tree::collectRetiredItems() {
+    if (retiredL0Items.empty() && retiredL1Items.empty() && retiredL2Items.empty() && !dictionary.hasRetiredIds()) {
+        return;
+    }
+
+    auto& epochManager = memDb->getEpochManager();
+    auto safeEpoch = epochManager.safeEpoch();
 
-            txn->traversalTrace[level] = i + 1;
-            if (txn->traversalTrace[level] > 15) {
-                txn->traversalTrace[level] = 0;
-                *indexUpdate = *indexUpdate + 1;
+    retiredL0Items.collect(safeEpoch, [this](offset l0Offset) {
+        freeL0Items.push_back(l0Offset);
+    });
+
+    // Payloads stay readable until no reader can reach the L1 anymore
+    retiredL1Items.collect(safeEpoch, [&](offset l1Offset) {
+        if (options.internPayloads) {
+            for (const auto& item : accessRowIds(l1Offset)) {
+                dictionary.release(item.rowId, epochManager.retireEpoch());
             }
-            return l0Item->children[i];
         }
+        accessL1Item(l1Offset).items.clear();
+        if (hasIdPayloads()) {
+            accessRowIds(l1Offset).clear();
+        }
+        freeL1Items.push_back(l1Offset);
+    });
+    retiredL2Items.collect(safeEpoch, [](std::list<L2Item>&) {});
+    dictionary.collect(safeEpoch);
+}
+
+bool Tree::compact() {
+    for (int attempt = 0; attempt < COMPACTION_ATTEMPTS; attempt++) {
+        std::unique_lock lock(this->mutex);
+        uint64_t version = structureVersion;
+        bool stale = false;
+        size_t copied = 0;
+
+        // The nodes are copied straight from the live arena, the latch is only held for a chunk of them at a time
+        std::vector<L0Item> relayout;
+        std::vector<uint32_t> relayoutCounts;
+        relayout.reserve(l0Items.capacity());
+        relayout.emplace_back(accessL0Item(rootElementOffset));
+        if (options.subtreeCounts) {
+            relayoutCounts.reserve(l0Items.capacity());
+            relayoutCounts.emplace_back(subtreeCount(rootElementOffset));
+        }
+
+        // L1 offsets stay the same
+        auto relocate = [&](offset parent, uint8_t index) -> offset {
+            if (++copied % COMPACTION_CHUNK_NODES == 0) {
+                lock.unlock();
+                std::this_thread::yield();
+                lock.lock();
+                stale |= version != structureVersion;
+            }
 
-        if (isNodeVisitable(l0Item->children[i])) {
-            L0Item* next = &accessL0Item(l0Item->children[i]);
+            offset child = relayout[parent].children[index];
+            if (stale || !isNodeVisitable(child) || isL1Node(child)) {
+                return NO_CHILD;
+            }
 
-            uint32_t idx = i;
-            offset l1Item = recursiveFindL1(txn, level + 1, next, &idx);
+            offset newOffset = markAsVisitable(relayout.size());
+            relayout.emplace_back(accessL0Item(child));
+            if (options.subtreeCounts) {
+                relayoutCounts.emplace_back(subtreeCount(child));
+            }
+            relayout[parent].children[index] = newOffset;
+            return newOffset;
+        };
+
+        // The top levels are hit by every lookup, lay them out breadth-first so they stay cache resident together
+        std::vector<offset> frontier {rootElementOffset};
+        while (true) {
+            size_t nextLevelSize = 0;
+            for (auto l0Offset : frontier) {
+                for (auto child : relayout[l0Offset].children) {
+                    nextLevelSize += isNodeVisitable(child) && !isL1Node(child);
+                }
+            }
 
-            if (txn) {
-                txn->traversalTrace[level] = idx;
+            if (nextLevelSize == 0 || relayout.size() + nextLevelSize > COMPACTION_TOP_NODES) {
+                break;
             }
 
-            if ((idx > 15)) {
-                *indexUpdate = *indexUpdate + 1;
-                txn->traversalTrace[level] = 0;
+            std::vector<offset> nextLevel;
+            for (auto l0Offset : frontier) {
+                for (uint8_t i = 0; i < 16; i++) {
+                    offset newOffset = relocate(l0Offset, i);
+                    if (isNodePresent(newOffset)) {
+                        nextLevel.push_back(newOffset);
+                    }
+                }
             }
-            if (isL1Node(l1Item)) {
-                return l1Item;
+            frontier.swap(nextLevel);
+        }
+
+        // Below that each subtree is laid out depth-first in one contiguous block
+        std::vector<std::pair<offset, uint8_t>> stack;
+        for (auto l0Offset : frontier) {
+            stack.emplace_back(l0Offset, 0);
+            while (!stack.empty()) {
+                auto& top = stack.back();
+                if (top.second == 16) {
+                    stack.pop_back();
+                    continue;
+                }
+
+                offset parent = top.first;
+                offset newOffset = relocate(parent, top.second++);
+                if (isNodePresent(newOffset)) {
+                    stack.emplace_back(newOffset, 0);
+                }
             }
         }
+
+        // A node allocated or freed between two chunks may be missing from the copy or in it twice
+        if (stale || version != structureVersion) {
+            continue;
+        }
+
+        // Every walk of the inner nodes holds the latch, so the old arena can go right away
+        std::swap(l0Items, relayout);
+        l0Counts.swap(relayoutCounts);
+        freeL0Items.clear();
+        retiredL0Items.clear();
+        structureVersion++;
+        return true;
     }
 
-    *indexUpdate = *indexUpdate + 1;
-    txn->traversalTrace[level] = 0;
-    return NO_CHILD;
+    return false;
+}
+
+ErrCode Tree::countRange(const KeyRange *range, size_t *count) {
+    if (!options.subtreeCounts) {
+        return FAILURE;
+    }
+
+    std::array<uint8_t, max_size()> keyData {};
+    std::lock_guard lock(this->mutex);
+
+    size_t lowRank = 0;
+    if (range->lowType != UNBOUNDED) {
+        encodeKey(&range->low, keyData.data());
+        lowRank = countKeysBefore(keyData.data(), range->lowType == EXCLUSIVE);
+    }
+
+    size_t highRank = subtreeCount(rootElementOffset);
+    if (range->highType != UNBOUNDED) {
+        keyData.fill(0);
+        encodeKey(&range->high, keyData.data());
+        highRank = countKeysBefore(keyData.data(), range->highType == INCLUSIVE);
+    }
+
+    *count = highRank > lowRank ? highRank - lowRank : 0;
+    return SUCCESS;
+}
+
+ErrCode Tree::rankOfKey(const Key *key, size_t *rank) {
+    if (!options.subtreeCounts) {
+        return FAILURE;
+    }
+
+    std::array<uint8_t, max_size()> keyData {};
+    encodeKey(key, keyData.data());
+
+    std::lock_guard lock(this->mutex);
+    *rank = countKeysBefore(keyData.data(), false);
+    return SUCCESS;
+}
+
+ErrCode Tree::selectKey(size_t rank, Key *key) {
+    if (!options.subtreeCounts) {
+        return FAILURE;
+    }
+
+    std::lock_guard lock(this->mutex);
+    if (rank >= subtreeCount(rootElementOffset)) {
+        return KEY_NOTFOUND;
+    }
+
+    offset current = rootElementOffset;
+    while (true) {
+        const L0Item& l0Item = accessL0Item(current);
+        offset next = NO_CHILD;
+
+        for (auto child : l0Item.children) {
+            size_t weight = subtreeWeight(child);
+            if (rank < weight) {
+                next = child;
+                break;
+            }
+            rank -= weight;
+        }
+
+        // The counts of a subtree always add up, a missing child means they are corrupted
+        if (!isNodeVisitable(next)) {
+            return FAILURE;
+        }
+
+        if (isL1Node(next)) {
+            decodeKey(accessL1Item(next), key);
+            return SUCCESS;
+        }
+
+        current = next;
+    }
+}
+
+size_t Tree::countKeysBefore(const uint8_t *keyData, bool inclusive) {
+    size_t rank = 0;
+    offset current = rootElementOffset;
+
+    for (uint32_t level = 0; level < LEVELS[this->keyType]; level++) {
+        const L0Item& l0Item = accessL0Item(current);
+        uint32_t index = calculateIndex(keyData, level);
+
+        for (uint32_t i = 0; i < index; i++) {
+            rank += subtreeWeight(l0Item.children[i]);
+        }
+
+        offset child = l0Item.children[index];
+        if (!isNodeVisitable(child)) {
+            break;
+        }
+
+        if (isL1Node(child)) {
+            int cmp = memcmp(accessL1Item(child).keyData.data(), keyData, SIZES[this->keyType]);
+            if (cmp < 0 || (cmp == 0 && inclusive)) {
+                rank++;
+            }
+            break;
+        }
+
+        current = child;
+    }
+
+    return rank;
+}
+
+size_t Tree::subtreeWeight(offset child) {
+    if (!isNodeVisitable(child)) {
+        return 0;
+    }
+    return isL1Node(child) ? 1 : subtreeCount(child);
+}
+
+uint32_t Tree::countSubtree(offset l0Offset) {
+    uint32_t count = 0;
+    for (auto child : accessL0Item(l0Offset).children) {
+        if (isNodeVisitable(child)) {
+            count += isL1Node(child) ? 1 : countSubtree(child);
+        }
+    }
+
+    subtreeCount(l0Offset) = count;
+    return count;
+}
+
+void Tree::addKeyToSubtreeCounts(const std::array<offset, max_levels()>& path, size_t depth) {
+    if (!options.subtreeCounts) {
+        return;
+    }
+
+    for (size_t i = 0; i < depth; i++) {
+        subtreeCount(path[i])++;
+    }
+}
+
+void Tree::setSubtreeCount(offset l0Offset, uint32_t count) {
+    if (options.subtreeCounts) {
+        subtreeCount(l0Offset) = count;
+    }
+}
+
+IndexStatistics Tree::statistics() {
+    std::lock_guard lock(this->mutex);
+
+    IndexStatistics stats {};
+    stats.l0Items = l0Items.size();
+    stats.l1Items = l1Items.size();
+    stats.freeL0Items = freeL0Items.size();
+    stats.freeL1Items = freeL1Items.size();
+    stats.retiredL0Items = retiredL0Items.size();
+    stats.retiredL1Items = retiredL1Items.size();
+    stats.hotKeyHits = hotKeyHits;
+    stats.hotKeyMisses = hotKeyMisses;
+    stats.keyFilterRejections = keyFilterRejections;
+    stats.bulkLoadTasks = bulkLoadTasks;
+    return stats;
 }
 
+offset Tree::findAdjacentL1Item(ReadPosition* position) {
+    auto& trace = position->traversalTrace;
+    auto& path = position->path;
+
+    // The trace holds the next child to visit per level, ascending from 0 or descending from 16 (one past the child)
+    const bool descending = position->descending;
+    const uint8_t levelStart = descending ? 16 : 0;
+    const uint8_t levelEnd = descending ? 0 : 16;
+
+    if (position->exhausted) {
+        // The last key was returned before, the call after the end starts over like a fresh scan
+        position->exhausted = false;
+        position->pathDepth = 0;
+        return NO_CHILD;
+    }
+
+    // A structural change may have moved the keys around the trace, e.g. a delete pulls an L1 item up into a slot the
+    // trace has already passed, so the trace is positioned again behind the last key
+    if (position->pathDepth > 0 && position->pathVersion != structureVersion) {
+        seekTrace(*position, position->anchorKey.data(), position->anchorInclusive);
+    }
 
+    // The L0 items along the trace are still the same, so the scan resumes at the deepest one instead of descending
+    // from the root again
+    uint32_t level = 0;
+    if (position->pathDepth > 0) {
+        level = position->pathDepth - 1;
+    }
+    else {
+        path[0] = rootElementOffset;
+    }
+    position->pathVersion = structureVersion;
 
+    while (true) {
+        L0Item* l0Item = &accessL0Item(path[level]);
+        bool descended = false;
+
+        while (trace[level] != levelEnd) {
+            uint32_t i = descending ? trace[level] - 1 : trace[level];
+            offset child = l0Item->children[i];
+
+            if (isL1Node(child)) {
+                // Advance the odometer past this item, carrying into the levels above
+                trace[level] = descending ? i : i + 1;
+                while (trace[level] == levelEnd) {
+                    trace[level] = levelStart;
+                    if (level == 0) {
+                        position->exhausted = true;
+                        break;
+                    }
+                    level--;
+                    trace[level] = descending ? trace[level] - 1 : trace[level] + 1;
+                }
+                position->pathDepth = level + 1;
+                return child;
+            }
 
+            if (isNodeVisitable(child)) {
+                path[level + 1] = child;
+                level++;
+                descended = true;
+                break;
+            }
 
+            trace[level] = descending ? i : i + 1;
+        }
 
+        if (descended) {
+            continue;
+        }
 
+        trace[level] = levelStart;
+        if (level == 0) {
+            position->pathDepth = 0;
+            return NO_CHILD;
+        }
+        level--;
+        trace[level] = descending ? trace[level] - 1 : trace[level] + 1;
+    }
+}
@@ -6,59 +6,315 @@
 
 #include <map>
 #include <string>
+#include <string_view>
+#include <list>
+#include <atomic>
 #include <vector>
 #include <shared_mutex>
 #include <mutex>
 #include <memory>
+#include <algorithm>
+#include <cassert>
 
 #include "server.h"
+#include "server_ext.h"
 #include "L0Item.h"
 #include "L2Item.h"
 #include "L1Item.h"
 #include "Transaction.h"
+#include "Epoch.h"
+#include "PayloadDictionary.h"
+#include "HashIndex.h"
+#include "KeyFilter.h"
 #include "types.h"
 class MemDB;
 
+// Number of optimistic rebuilds before compact() gives up on a busy tree
+constexpr int COMPACTION_ATTEMPTS = 3;
+// Number of nodes compact() copies per acquisition of the latch
+constexpr size_t COMPACTION_CHUNK_NODES = 1024;
+// Number of nodes compact() lays out breadth-first at the top of the tree
+constexpr size_t COMPACTION_TOP_NODES = 4096;
+// Number of sorted records ahead of the current one whose payload a bulk load prefetches
+constexpr size_t BULK_LOAD_PREFETCH_DISTANCE = 16;
+// Number of levels below the common prefix of a bulk load at which its subtrees are built concurrently, 2 means one
+// subtree per byte following the prefix
+constexpr uint32_t BULK_LOAD_TASK_LEVELS = 2;
+// Number of lookups getBatch advances in lockstep, enough to overlap the memory latency of the group
+constexpr size_t GET_BATCH_GROUP_SIZE = 32;
+// Number of 32 bit lanes of an AVX2 register
+constexpr size_t SIMD_LANES = 8;
+static_assert(GET_BATCH_GROUP_SIZE % SIMD_LANES == 0, "getBatch groups are split into whole vectors");
+// Number of unlinked payload entries after which a delete tries to free the ones no view can reach anymore
+constexpr size_t L2_RETIRE_BATCH = 64;
+// Number of keys the key filter of an empty index is sized for, it doubles whenever it is exceeded
+constexpr size_t KEY_FILTER_INITIAL_KEYS = 1024;
 
 
 
 
+struct BulkLoadInput {
+    size_t keySize;
+    // Encoded keys, keySize bytes each, sorted
+    std::vector<uint8_t> keys;
+    // Input position of each sorted key
+    std::vector<uint32_t> order;
+    const Record* records;
+    uint32_t transactionId;
+    // Level of the subtrees built concurrently
+    uint32_t taskLevel;
+
+    const uint8_t* key(size_t i) const {
+        return keys.data() + i * keySize;
+    }
+
+    const char* payload(size_t i) const {
+        return records[order[i]].payload;
+    }
+};
+
+// Subtree built by one worker of a (parallel) bulk load
+struct BulkLoadTask {
+    offset l0Offset;
+    uint32_t level;
+    size_t first;
+    size_t last;
+
+    size_t l0Count;
+    size_t l1Count;
+    size_t nextL0;
+    size_t nextL1;
+};
+
+// Encoded bounds of a deleteRange call and the nodes it detached
+struct RangeDelete {
+    size_t keySize;
+    bool lowBounded;
+    bool lowInclusive;
+    std::array<uint8_t, max_size()> low;
+    bool highBounded;
+    bool highInclusive;
+    std::array<uint8_t, max_size()> high;
+
+    std::vector<offset> releasedL0Items;
+    std::vector<offset> releasedL1Items;
+    size_t deletedRecords;
+
+    bool contains(const uint8_t* key) const {
+        if (lowBounded) {
+            int cmp = memcmp(key, low.data(), keySize);
+            if (cmp < 0 || (cmp == 0 && !lowInclusive)) {
+                return false;
+            }
+        }
+        if (highBounded) {
+            int cmp = memcmp(key, high.data(), keySize);
+            if (cmp > 0 || (cmp == 0 && !highInclusive)) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+// L0 items along the path to the largest key, appends of larger keys start from them. Valid while the tree is at
+// version and depth is not 0.
+struct RightEdge {
+    std::array<offset, max_levels()> path {};
+    uint32_t depth = 0;
+    std::array<uint8_t, max_size()> keyData {};
+    offset l1Offset = NO_CHILD;
+    uint64_t version = 0;
+};
+
+enum class BatchLookupState {
+    TRAVERSE,
+    VERIFY,
+    DONE
+};
+
+// State of one lookup of a getBatch group
+struct BatchLookup {
+    offset current;
+    uint32_t level;
+    BatchLookupState state;
+};
+
 class Tree{
 public:
     KeyType keyType;
-    explicit Tree(KeyType keyType, MemDB* memDb);
-    ErrCode get(TxnState *txn, Record *record);
+    Tree(KeyType keyType, MemDB* memDb, const IndexOptions& options);
+    ErrCode get(TxnState *txn, Record *record, LookupFinger *finger = nullptr);
+    ErrCode getBatch(TxnState *txn, Record *records, size_t count, ErrCode *results);
     ErrCode getNext(TxnState *txn, Record *record);
+    ErrCode getView(TxnState *txn, const Key *key, RecordView *view, LookupFinger *finger = nullptr);
+    ErrCode getNextView(TxnState *txn, RecordView *view);
+    void acquireReadGuard();
+    void releaseReadGuard();
+    // Entry points of the typed Index<K> API, the caller encodes and decodes the keys
+    ErrCode getEncoded(TxnState *txn, const std::array<uint8_t, max_size()>& keyData, char *payload, LookupFinger *finger = nullptr);
+    ErrCode getNextEncoded(TxnState *txn, std::array<uint8_t, max_size()>& keyData, char *payload);
+    ErrCode insertEncoded(TxnState *txn, const std::array<uint8_t, max_size()>& keyData, const char *payload);
+    ErrCode updateEncoded(TxnState *txn, const std::array<uint8_t, max_size()>& keyData, const char *oldPayload, const char *newPayload);
+    ErrCode deleteEncoded(TxnState *txn, const std::array<uint8_t, max_size()>& keyData, const char *payload);
+    const IndexOptions& indexOptions() const {
+        return options;
+    }
+    ErrCode getPrev(TxnState *txn, Record *record);
+    ErrCode getNextBatch(TxnState *txn, Record *records, size_t count, size_t *produced);
+    ErrCode seekRange(TxnState *txn, const KeyRange *range, bool descending);
+    ErrCode scanRange(TxnState *txn, const KeyRange *range, bool descending, Record *records, size_t count, size_t *produced);
+    ErrCode prefixScan(TxnState *txn, const char *prefix, Record *records, size_t count, size_t *produced);
     ErrCode insertRecord(TxnState *txn, Key *k, const char* payload);
     ErrCode deleteRecord(TxnState *txn, Record *record);
+    ErrCode updateRecord(TxnState *txn, Key *k, const char* oldPayload, const char* newPayload);
+    ErrCode upsertRecord(TxnState *txn, Key *k, const char* oldPayload, const char* newPayload);
+    ErrCode deleteRange(const KeyRange *range, size_t *deleted);
+    ErrCode insertRowId(TxnState *txn, Key *k, uint64_t rowId);
+    ErrCode getRowId(TxnState *txn, Key *k, uint64_t *rowId);
+    ErrCode getNextRowId(TxnState *txn, Key *k, uint64_t *rowId);
+    ErrCode deleteRowId(TxnState *txn, Key *k, uint64_t rowId);
+    void truncate();
+    ErrCode bulkLoad(const Record *records, size_t count, unsigned threads);
     void commit(uint32_t transactionId);
     void abort(uint32_t transactionId);
+    bool compact();
+    ErrCode countRange(const KeyRange *range, size_t *count);
+    ErrCode rankOfKey(const Key *key, size_t *rank);
+    ErrCode selectKey(size_t rank, Key *key);
+    IndexStatistics statistics();
 
 private:
     MemDB* memDb;
     std::vector<TransactionLogItem> transactionLogItems;
+    std::vector<RowIdLogItem> rowIdLogItems;
+    // While an abort undoes its entries, the slots it releases are collected here and purged from the logs at the end
+    bool deferLogPurges;
+    std::vector<offset> deferredLogPurges;
     std::mutex mutex;
+    IndexOptions options;
     std::vector<L0Item> l0Items;
+    // Number of keys below every L0 item, only maintained with subtreeCounts
+    std::vector<uint32_t> l0Counts;
     std::vector<L1Item> l1Items;
+    // Row ids or interned payload ids of every L1 item, parallel to l1Items and only kept with hasIdPayloads()
+    std::vector<std::vector<RowIdItem>> l1RowIds;
+    std::vector<offset> freeL0Items;
+    std::vector<offset> freeL1Items;
+    RetireList<offset> retiredL0Items;
+    RetireList<offset> retiredL1Items;
+    RetireList<std::list<L2Item>> retiredL2Items;
+    // Only used with internPayloads, the entries then reference their payloads by id
+    PayloadDictionary dictionary;
+    // Number of ReadGuards on this tree, while there are any payloads are not overwritten in place
+    std::atomic<uint32_t> activeReadGuards;
     offset rootElementOffset;
+    uint64_t structureVersion;
+    offset largestL1Item;
+    uint64_t largestL1ItemVersion;
+    RightEdge rightEdge;
     std::map<uint32_t, ReadPosition> readPositions;
+    // Direct-mapped cache of findL1Item, empty without hotKeyCacheSize. Released L1 items are evicted from it.
+    std::vector<offset> hotKeys;
+    size_t hotKeyHits;
+    size_t hotKeyMisses;
+    // All live L1 items by key, only maintained with hashIndex
+    HashIndex hashIndex;
+    // All live keys, only maintained with keyFilter
+    KeyFilter keyFilter;
+    size_t keyFilterRejections;
+    size_t bulkLoadTasks;
 
 
+    bool canTraverseBatchSimd();
+    void traverseBatchSimd(const uint8_t* keys, size_t count, BatchLookup* lookups);
+    ErrCode readFirstVisible(ReadPosition* position, uint32_t transactionId, offset l1Offset, Record *record);
+    const char* findFirstVisible(ReadPosition* position, uint32_t transactionId, offset l1Offset);
+    ErrCode findNextVisible(ReadPosition& position, uint32_t transactionId, bool descending, const char** payload);
+    bool findVisibleRowId(ReadPosition& position, uint32_t transactionId, offset l1Offset);
+    void viewRecord(const L1Item& l1Item, const char* payload, RecordView *view);
+    ErrCode scanLocked(ReadPosition& position, uint32_t transactionId, Record *record, bool descending);
+    ErrCode scanBatchLocked(ReadPosition& position, uint32_t transactionId, Record *records, size_t count, size_t *produced, bool descending);
+    void seekLocked(ReadPosition& position, const KeyRange *range, bool descending);
+    void positionAtKey(ReadPosition& position, const uint8_t *keyData);
+    void resetTrace(ReadPosition& position);
+    void seekTrace(ReadPosition& position, const uint8_t *keyData, bool inclusive);
+    bool isPastBound(const ReadPosition& position, const L1Item& l1Item);
+    void encodeKey(const Key *key, uint8_t *keyData);
+    void decodeKey(const L1Item& l1Item, Key *key);
+    ErrCode insertLocked(TxnState *txn, uint32_t transactionId, const std::array<uint8_t, max_size()>& keyData, const char* payload);
+    ErrCode insertIntoL1Item(TxnState *txn, uint32_t transactionId, offset l1Offset, const char* payload);
+    ErrCode updateLocked(TxnState *txn, uint32_t transactionId, offset l1Offset, const char* oldPayload, const char* newPayload);
+    ErrCode updateInterned(TxnState *txn, uint32_t transactionId, offset l1Offset, const char* oldPayload, const char* newPayload);
+    void bulkLoadTopLevels(offset l0Offset, uint32_t level, const BulkLoadInput& input, size_t first, size_t last, std::vector<BulkLoadTask>& tasks);
+    void countBulkLoadNodes(uint32_t level, const BulkLoadInput& input, size_t first, size_t last, BulkLoadTask& task);
+    void bulkLoadChildren(offset l0Offset, uint32_t level, const BulkLoadInput& input, size_t first, size_t last, BulkLoadTask& task);
+    void fillBulkLoadL1Item(L1Item& l1Item, const BulkLoadInput& input, size_t first, size_t last);
     offset findOrConstructL1Item(const std::array<uint8_t, max_size()>& keyData);
+    void trackRightEdge(const std::array<uint8_t, max_size()>& keyData, const std::array<offset, max_levels()>& path, size_t depth,
+                        offset l1Offset, offset splitL1, bool edgeValid);
+    bool isOnRightEdge(const uint8_t* keyData, const std::array<offset, max_levels()>& path, size_t depth);
+    void initArenas();
+    offset allocateL0Item();
+    offset allocateL1Item(const std::array<uint8_t, max_size()>& keyData);
+    void growL1Items(size_t capacity);
+    void rewriteL2Item(std::list<L2Item>& items, std::list<L2Item>::iterator it, const char* payload, uint32_t timestamp);
+    void retireL2Item(std::list<L2Item>& items, std::list<L2Item>::iterator it);
+    void releaseL0Item(offset l0Offset);
+    void releaseL1Item(offset l1Offset);
+    void collectRetiredItems();
     offset findL1ItemWithSmallestKey();
-    offset findL1Item(const uint8_t* data, TxnState* txn);
-    offset recursiveFindL1(TxnState *txn, uint32_t level, L0Item* l0Item, uint32_t* indexUpdate);
+    offset findL1ItemWithLargestKey();
+    offset findL1Item(const uint8_t* data, LookupFinger* finger = nullptr);
+    offset findL1ItemInTrie(const uint8_t* data, LookupFinger* finger);
+    offset findL1ItemFromFinger(const uint8_t* data, LookupFinger& finger);
+    size_t hashKey(const uint8_t* data);
+    void forgetL1Item(offset l1Offset);
+    void rebuildKeyFilter(size_t keys);
+    offset findAdjacentL1Item(ReadPosition* position);
     void removeTransaction(uint32_t transactionId);
     bool isTransactionActive(uint32_t transactionID);
+    bool isVisible(const L2Item& l2Item, uint32_t transactionId);
+    bool isVisible(uint32_t timestamp, uint32_t transactionId);
     uint32_t getTransactionId(TxnState *txn);
-    RecursiveDeleteResult recursiveDelete(uint32_t level, L0Item* l0Item, const uint8_t *keyData, const char* payload);
+    size_t countKeysBefore(const uint8_t *keyData, bool inclusive);
+    size_t subtreeWeight(offset child);
+    uint32_t countSubtree(offset l0Offset);
+    void addKeyToSubtreeCounts(const std::array<offset, max_levels()>& path, size_t depth);
+    void setSubtreeCount(offset l0Offset, uint32_t count);
+    RecursiveDeleteResult deleteFromRoot(const uint8_t *keyData, const char* payload, const uint64_t* rowId = nullptr);
+    size_t deleteRangeBelow(offset l0Offset, uint32_t level, bool lowTight, bool highTight, RangeDelete& del);
+    size_t releaseSubtree(offset child, RangeDelete& del);
+    void releaseDetachedItems(RangeDelete& del);
+    RecursiveDeleteResult recursiveDelete(uint32_t level, L0Item* l0Item, const uint8_t *keyData, const char* payload, const uint64_t* rowId);
+
+    // Row ids and interned payloads both live in l1RowIds
+    bool hasIdPayloads() const {
+        return options.rowIdPayloads || options.internPayloads;
+    }
 
     L0Item& accessL0Item(offset i) {
         return l0Items[getIndexFromOffset(i)];
     }
 
+    uint32_t& subtreeCount(offset i) {
+        return l0Counts[getIndexFromOffset(i)];
+    }
+
     L1Item& accessL1Item(offset i) {
         return l1Items[getL1IndexFromOffset(i)];
     }
+
+    std::vector<RowIdItem>& accessRowIds(offset i) {
+        assert(hasIdPayloads());
+        return l1RowIds[getL1IndexFromOffset(i)];
+    }
+
+    // Drops the entries of both transaction logs the predicate matches
+    template<typename Predicate>
+    void eraseLogItems(Predicate predicate) {
+        transactionLogItems.erase(std::remove_if(transactionLogItems.begin(), transactionLogItems.end(), predicate), transactionLogItems.end());
+        rowIdLogItems.erase(std::remove_if(rowIdLogItems.begin(), rowIdLogItems.end(), predicate), rowIdLogItems.end());
+    }
 };
 
@@ -33,6 +33,47 @@ inline size_t varcharToByteArray(uint8_t* dest, const uint8_t* src) {
     return offset;
 }
 
+inline size_t varcharPaddingLength(const uint8_t* src) {
+    // Skip the padding a word at a time, keys are usually much shorter than MAX_VARCHAR_LEN
+    size_t offset = 0;
+    for (; offset + sizeof(uint64_t) <= MAX_VARCHAR_LEN; offset += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, src + offset, sizeof(uint64_t));
+        if (word) {
+            break;
+        }
+    }
+    while (offset < MAX_VARCHAR_LEN && !src[offset]) {
+        offset++;
+    }
+
+    return offset;
+}
+
+inline size_t byteArrayToVarchar(char* dest, const uint8_t* src) {
+    size_t offset = varcharPaddingLength(src);
+    size_t len = MAX_VARCHAR_LEN - offset;
+    memcpy(dest, src + offset, len);
+    dest[len] = '\0';
+    return len;
+}
+
+inline size_t varcharToLeftAlignedByteArray(uint8_t* dest, const uint8_t* src) {
+    // The zero padding terminates the string, so shorter strings order before their extensions
+    size_t len = strnlen((char*) src, MAX_VARCHAR_LEN);
+
+    memcpy(dest, src, len);
+    return len;
+}
+
+inline size_t leftAlignedByteArrayToVarchar(char* dest, const uint8_t* src) {
+    size_t len = strnlen((const char*) src, MAX_VARCHAR_LEN);
+
+    memcpy(dest, src, len);
+    dest[len] = '\0';
+    return len;
+}
+
 inline std::pair<uint8_t, uint8_t> calculateNextTwoIndices(const uint8_t* data, uint32_t level_div_by_two) {
     uint8_t byte = *(data + level_div_by_two);
 
@@ -58,6 +99,27 @@ inline void prepareKeyData(const Key* k, uint8_t* dest) {
     }
 }
 
+// Number of leading nibbles two encoded keys share, i.e. the number of trie levels their lookups have in common
+inline uint32_t commonPrefixNibbles(const uint8_t* a, const uint8_t* b, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t diff = __builtin_bswap64(*reinterpret_cast<const uint64_t*>(a + i)) ^
+                        __builtin_bswap64(*reinterpret_cast<const uint64_t*>(b + i));
+        if (diff) {
+            return i * 2 + __builtin_clzll(diff) / 4;
+        }
+    }
+
+    for (; i < size; i++) {
+        uint8_t diff = a[i] ^ b[i];
+        if (diff) {
+            return i * 2 + (diff & 0xF0 ? 0 : 1);
+        }
+    }
+
+    return size * 2;
+}
+
 inline uint32_t calculateIndex(const uint8_t* data, uint32_t level) {
     // Assuming prefix length = 4
 
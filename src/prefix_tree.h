@@ -0,0 +1,636 @@
+//
+// Created by lukas on 19.10.26.
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/*
+ * A standalone ordered container in the style of a generalized prefix tree,
+ * for users that need arbitrary value types and no transactions, payload
+ * limits or SIGMOD API.
+ *
+ * It is a separate data structure, not the core of the index: Tree does not
+ * use it, and neither shares code with the other nor is kept in step with
+ * it. None of the index features are part of it (transactions, epoch
+ * reclamation, subtree counts, compaction, bulk load, hot keys), and keys
+ * are limited to fixed size types with a prefix_tree_traits specialization,
+ * there is none for variable length strings.
+ *
+ * Inner nodes hold 2^PrefixBits children in one array, every level consumes
+ * PrefixBits of the binary-comparable form of the key. A leaf hangs as high
+ * up as its prefix is unique: it is pushed down by a chain of inner nodes
+ * when a key with the same prefix arrives, and pulled up again when it is
+ * the last key below its parent.
+ *
+ * Nodes and leaves live in arrays and are referenced by offsets, so
+ * iterators stay valid across inserts. References to the elements do not,
+ * the arrays may grow. Erasing invalidates iterators and references to the
+ * erased element only.
+ *
+ * Iterators keep the path to their leaf, so stepping to the neighbouring
+ * leaf is amortized constant. The path is found again from the root when
+ * nodes were allocated or freed since.
+ */
+
+// Maps a key to bytes whose lexicographic order is the order of the keys, specialize it for other fixed size keys
+template<typename Key, typename Enable = void>
+struct prefix_tree_traits;
+
+// Integers are stored big-endian, signed ones with the sign bit flipped so that negative keys sort first
+template<typename Key>
+struct prefix_tree_traits<Key, std::enable_if_t<std::is_integral_v<Key> && !std::is_same_v<Key, bool>>> {
+    static constexpr size_t size = sizeof(Key);
+
+    static void encode(const Key& key, uint8_t* dest) {
+        using Unsigned = std::make_unsigned_t<Key>;
+        auto value = static_cast<Unsigned>(key);
+        if constexpr (std::is_signed_v<Key>) {
+            value ^= static_cast<Unsigned>(Unsigned(1) << (sizeof(Key) * 8 - 1));
+        }
+
+        for (size_t i = 0; i < size; i++) {
+            dest[size - 1 - i] = static_cast<uint8_t>(value >> (i * 8));
+        }
+    }
+};
+
+template<size_t N>
+struct prefix_tree_traits<std::array<uint8_t, N>> {
+    static constexpr size_t size = N;
+
+    static void encode(const std::array<uint8_t, N>& key, uint8_t* dest) {
+        memcpy(dest, key.data(), N);
+    }
+};
+
+template<typename Key, typename Value, unsigned PrefixBits = 4>
+class prefix_tree {
+    static_assert(PrefixBits == 1 || PrefixBits == 2 || PrefixBits == 4 || PrefixBits == 8,
+                  "a level consumes a part of one key byte");
+
+    using traits = prefix_tree_traits<Key>;
+    using KeyBytes = std::array<uint8_t, traits::size>;
+
+    static constexpr size_t FANOUT = size_t(1) << PrefixBits;
+    // Children whose presence fits into one 64 bit mask
+    static constexpr size_t CHUNK = FANOUT < 64 ? FANOUT : 64;
+    static constexpr size_t LEVELS = traits::size * 8 / PrefixBits;
+    // The root is node 0 and never a child, so 0 marks an empty slot
+    static constexpr uint32_t NO_CHILD = 0;
+    static constexpr uint32_t LEAF = 0x80000000;
+
+    struct Node {
+        std::array<uint32_t, FANOUT> children {};
+    };
+
+    struct Leaf {
+        KeyBytes bytes;
+        std::optional<std::pair<const Key, Value>> value;
+    };
+
+    // Nodes from the root down to the parent of a leaf, unknown while depth is 0
+    struct Cursor {
+        std::array<uint32_t, LEVELS> path;
+        uint32_t depth = 0;
+        uint64_t version = 0;
+    };
+
+public:
+    using key_type = Key;
+    using mapped_type = Value;
+    using value_type = std::pair<const Key, Value>;
+    using size_type = size_t;
+    using difference_type = std::ptrdiff_t;
+    using reference = value_type&;
+    using const_reference = const value_type&;
+
+    template<bool Const>
+    class basic_iterator {
+    public:
+        using iterator_category = std::bidirectional_iterator_tag;
+        using value_type = prefix_tree::value_type;
+        using difference_type = std::ptrdiff_t;
+        using pointer = std::conditional_t<Const, const value_type*, value_type*>;
+        using reference = std::conditional_t<Const, const value_type&, value_type&>;
+        using tree_pointer = std::conditional_t<Const, const prefix_tree*, prefix_tree*>;
+
+        basic_iterator() : tree(nullptr), leaf(NO_CHILD) {
+
+        }
+
+        basic_iterator(tree_pointer tree, uint32_t leaf) : tree(tree), leaf(leaf) {
+
+        }
+
+        basic_iterator(tree_pointer tree, uint32_t leaf, const Cursor& cursor) : tree(tree), leaf(leaf), cursor(cursor) {
+
+        }
+
+        // iterator converts to const_iterator
+        template<bool OtherConst, typename = std::enable_if_t<Const && !OtherConst>>
+        basic_iterator(const basic_iterator<OtherConst>& other) : tree(other.tree), leaf(other.leaf), cursor(other.cursor) {
+
+        }
+
+        reference operator*() const {
+            return *tree->accessLeaf(leaf).value;
+        }
+
+        pointer operator->() const {
+            return &**this;
+        }
+
+        basic_iterator& operator++() {
+            leaf = tree->step(leaf, cursor, true);
+            return *this;
+        }
+
+        basic_iterator operator++(int) {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
+
+        // Decrementing end() moves to the largest key
+        basic_iterator& operator--() {
+            if (leaf == NO_CHILD) {
+                leaf = tree->edgeLeaf(cursor, false);
+            }
+            else {
+                leaf = tree->step(leaf, cursor, false);
+            }
+            return *this;
+        }
+
+        basic_iterator operator--(int) {
+            auto old = *this;
+            --*this;
+            return old;
+        }
+
+        bool operator==(const basic_iterator& other) const {
+            return leaf == other.leaf;
+        }
+
+        bool operator!=(const basic_iterator& other) const {
+            return leaf != other.leaf;
+        }
+
+    private:
+        friend class prefix_tree;
+        template<bool> friend class basic_iterator;
+
+        tree_pointer tree;
+        uint32_t leaf;
+        Cursor cursor;
+    };
+
+    using iterator = basic_iterator<false>;
+    using const_iterator = basic_iterator<true>;
+
+    prefix_tree() : nodes(1), elements(0), version(0) {
+
+    }
+
+    iterator begin() {
+        Cursor cursor;
+        uint32_t leaf = edgeLeaf(cursor, true);
+        return iterator(this, leaf, cursor);
+    }
+
+    const_iterator begin() const {
+        Cursor cursor;
+        uint32_t leaf = edgeLeaf(cursor, true);
+        return const_iterator(this, leaf, cursor);
+    }
+
+    iterator end() {
+        return iterator(this, NO_CHILD);
+    }
+
+    const_iterator end() const {
+        return const_iterator(this, NO_CHILD);
+    }
+
+    size_t size() const {
+        return elements;
+    }
+
+    bool empty() const {
+        return elements == 0;
+    }
+
+    void clear() {
+        nodes.assign(1, Node {});
+        leaves.clear();
+        freeNodes.clear();
+        freeLeaves.clear();
+        elements = 0;
+        version++;
+    }
+
+    iterator find(const Key& key) {
+        return iterator(this, findLeaf(key));
+    }
+
+    const_iterator find(const Key& key) const {
+        return const_iterator(this, findLeaf(key));
+    }
+
+    size_t count(const Key& key) const {
+        return findLeaf(key) != NO_CHILD;
+    }
+
+    bool contains(const Key& key) const {
+        return findLeaf(key) != NO_CHILD;
+    }
+
+    iterator lower_bound(const Key& key) {
+        return iterator(this, seek(key, true));
+    }
+
+    const_iterator lower_bound(const Key& key) const {
+        return const_iterator(this, seek(key, true));
+    }
+
+    iterator upper_bound(const Key& key) {
+        return iterator(this, seek(key, false));
+    }
+
+    const_iterator upper_bound(const Key& key) const {
+        return const_iterator(this, seek(key, false));
+    }
+
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args) {
+        KeyBytes bytes;
+        traits::encode(key, bytes.data());
+
+        // Allocations may grow the arrays, so only offsets are kept across them
+        uint32_t node = 0;
+        for (size_t level = 0; level < LEVELS; level++) {
+            size_t index = indexAt(bytes.data(), level);
+            uint32_t child = nodes[node].children[index];
+
+            if (child == NO_CHILD) {
+                uint32_t leaf = allocateLeaf(bytes, key, std::forward<Args>(args)...);
+                nodes[node].children[index] = leaf;
+                elements++;
+                return {iterator(this, leaf), true};
+            }
+
+            if (child & LEAF) {
+                if (accessLeaf(child).bytes == bytes) {
+                    return {iterator(this, child), false};
+                }
+
+                // Push the existing leaf down until the two keys part
+                KeyBytes other = accessLeaf(child).bytes;
+                uint32_t leaf = allocateLeaf(bytes, key, std::forward<Args>(args)...);
+                for (size_t nested = level + 1; nested < LEVELS; nested++) {
+                    uint32_t inner = allocateNode();
+                    nodes[node].children[index] = inner;
+                    node = inner;
+
+                    size_t newIndex = indexAt(bytes.data(), nested);
+                    size_t oldIndex = indexAt(other.data(), nested);
+                    if (newIndex != oldIndex) {
+                        nodes[node].children[newIndex] = leaf;
+                        nodes[node].children[oldIndex] = child;
+                        break;
+                    }
+                    index = newIndex;
+                }
+
+                elements++;
+                return {iterator(this, leaf), true};
+            }
+
+            node = child;
+        }
+
+        return {end(), false};
+    }
+
+    std::pair<iterator, bool> insert(const value_type& value) {
+        return try_emplace(value.first, value.second);
+    }
+
+    template<typename M>
+    std::pair<iterator, bool> insert_or_assign(const Key& key, M&& mapped) {
+        auto result = try_emplace(key, std::forward<M>(mapped));
+        if (!result.second) {
+            result.first->second = std::forward<M>(mapped);
+        }
+        return result;
+    }
+
+    Value& operator[](const Key& key) {
+        return try_emplace(key).first->second;
+    }
+
+    size_t erase(const Key& key) {
+        KeyBytes bytes;
+        traits::encode(key, bytes.data());
+
+        if (!eraseBelow(0, 0, bytes)) {
+            return 0;
+        }
+
+        elements--;
+        return 1;
+    }
+
+    iterator erase(const_iterator position) {
+        iterator next(this, position.leaf, position.cursor);
+        ++next;
+        erase(position->first);
+        return next;
+    }
+
+    iterator erase(iterator position) {
+        return erase(const_iterator(position));
+    }
+
+private:
+    std::vector<Node> nodes;
+    std::vector<Leaf> leaves;
+    std::vector<uint32_t> freeNodes;
+    std::vector<uint32_t> freeLeaves;
+    size_t elements;
+    // Every change of the node structure allocates or frees a node, the cursors of iterators are stale then
+    uint64_t version;
+
+    static size_t indexAt(const uint8_t* bytes, size_t level) {
+        size_t bit = level * PrefixBits;
+        return (bytes[bit / 8] >> (8 - PrefixBits - bit % 8)) & (FANOUT - 1);
+    }
+
+    Leaf& accessLeaf(uint32_t leaf) {
+        return leaves[leaf & ~LEAF];
+    }
+
+    const Leaf& accessLeaf(uint32_t leaf) const {
+        return leaves[leaf & ~LEAF];
+    }
+
+    uint32_t allocateNode() {
+        version++;
+
+        if (!freeNodes.empty()) {
+            uint32_t node = freeNodes.back();
+            freeNodes.pop_back();
+            nodes[node] = Node {};
+            return node;
+        }
+
+        nodes.emplace_back();
+        return nodes.size() - 1;
+    }
+
+    template<typename... Args>
+    uint32_t allocateLeaf(const KeyBytes& bytes, const Key& key, Args&&... args) {
+        uint32_t index;
+        if (!freeLeaves.empty()) {
+            index = freeLeaves.back();
+            freeLeaves.pop_back();
+        }
+        else {
+            index = leaves.size();
+            leaves.emplace_back();
+        }
+
+        leaves[index].bytes = bytes;
+        leaves[index].value.emplace(std::piecewise_construct, std::forward_as_tuple(key), std::forward_as_tuple(std::forward<Args>(args)...));
+        return index | LEAF;
+    }
+
+    void releaseLeaf(uint32_t leaf) {
+        accessLeaf(leaf).value.reset();
+        freeLeaves.push_back(leaf & ~LEAF);
+    }
+
+    uint32_t findLeaf(const Key& key) const {
+        KeyBytes bytes;
+        traits::encode(key, bytes.data());
+
+        uint32_t node = 0;
+        for (size_t level = 0; level < LEVELS; level++) {
+            uint32_t child = nodes[node].children[indexAt(bytes.data(), level)];
+            if (child == NO_CHILD) {
+                return NO_CHILD;
+            }
+            if (child & LEAF) {
+                return accessLeaf(child).bytes == bytes ? child : NO_CHILD;
+            }
+            node = child;
+        }
+
+        return NO_CHILD;
+    }
+
+    // Bit i is set if child chunk * CHUNK + i is present. Built without branches, so that sparse nodes do not cost a
+    // misprediction per slot.
+    static uint64_t presentChildren(const Node& node, size_t chunk) {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < CHUNK; i++) {
+            mask |= uint64_t(node.children[chunk * CHUNK + i] != NO_CHILD) << i;
+        }
+        return mask;
+    }
+
+    // Index of the first present child at or behind from, FANOUT if there is none
+    static size_t firstChildFrom(const Node& node, size_t from) {
+        // Dense nodes, as in sequential scans, mostly have the next child present
+        if (from < FANOUT && node.children[from] != NO_CHILD) {
+            return from;
+        }
+        for (size_t chunk = from / CHUNK; chunk < FANOUT / CHUNK; chunk++) {
+            uint64_t mask = presentChildren(node, chunk);
+            if (chunk == from / CHUNK) {
+                mask &= ~uint64_t(0) << (from % CHUNK);
+            }
+            if (mask) {
+                return chunk * CHUNK + __builtin_ctzll(mask);
+            }
+        }
+        return FANOUT;
+    }
+
+    // Index of the last present child in front of end, FANOUT if there is none
+    static size_t lastChildBefore(const Node& node, size_t end) {
+        if (end > 0 && node.children[end - 1] != NO_CHILD) {
+            return end - 1;
+        }
+        for (size_t chunk = (end + CHUNK - 1) / CHUNK; chunk-- > 0;) {
+            uint64_t mask = presentChildren(node, chunk);
+            if (chunk == end / CHUNK) {
+                mask &= (uint64_t(1) << (end % CHUNK)) - 1;
+            }
+            if (mask) {
+                return chunk * CHUNK + 63 - __builtin_clzll(mask);
+            }
+        }
+        return FANOUT;
+    }
+
+    // The first or last leaf below node, the nodes on the way are appended to the cursor behind level
+    uint32_t descend(uint32_t node, size_t level, Cursor& cursor, bool forward) const {
+        while (!(node & LEAF)) {
+            cursor.path[level++] = node;
+
+            size_t i = forward ? firstChildFrom(nodes[node], 0) : lastChildBefore(nodes[node], FANOUT);
+
+            // Only the root can be empty
+            if (i == FANOUT) {
+                cursor.depth = 0;
+                return NO_CHILD;
+            }
+            node = nodes[node].children[i];
+        }
+
+        cursor.depth = level;
+        cursor.version = version;
+        return node;
+    }
+
+    uint32_t edgeLeaf(Cursor& cursor, bool forward) const {
+        return descend(0, 0, cursor, forward);
+    }
+
+    // Rebuilds the cursor of an existing leaf
+    void locate(const uint8_t* bytes, Cursor& cursor) const {
+        size_t level = 0;
+        uint32_t node = 0;
+        while (true) {
+            cursor.path[level] = node;
+            uint32_t child = nodes[node].children[indexAt(bytes, level)];
+            if (child & LEAF) {
+                break;
+            }
+            node = child;
+            level++;
+        }
+
+        cursor.depth = level + 1;
+        cursor.version = version;
+    }
+
+    // The leaf next to the given one in key order, or in front of it. Climbs up the cursor to the first node with a
+    // child on that side, then descends to its closest leaf.
+    uint32_t step(uint32_t leaf, Cursor& cursor, bool forward) const {
+        const uint8_t* bytes = accessLeaf(leaf).bytes.data();
+        if (cursor.depth == 0 || cursor.version != version) {
+            locate(bytes, cursor);
+        }
+
+        for (size_t level = cursor.depth; level-- > 0;) {
+            const Node& node = nodes[cursor.path[level]];
+            size_t index = indexAt(bytes, level);
+
+            size_t i = forward ? firstChildFrom(node, index + 1) : lastChildBefore(node, index);
+            if (i != FANOUT) {
+                return descend(node.children[i], level + 1, cursor, forward);
+            }
+        }
+
+        cursor.depth = 0;
+        return NO_CHILD;
+    }
+
+    uint32_t seek(const Key& key, bool inclusive) const {
+        KeyBytes bytes;
+        traits::encode(key, bytes.data());
+        return seekAfter(bytes.data(), inclusive);
+    }
+
+    // The smallest leaf past the key, or at it if inclusive
+    uint32_t seekAfter(const uint8_t* bytes, bool inclusive) const {
+        std::array<uint32_t, LEVELS> path;
+        size_t level = 0;
+        uint32_t node = 0;
+        while (true) {
+            path[level] = node;
+            uint32_t child = nodes[node].children[indexAt(bytes, level)];
+            if (child == NO_CHILD) {
+                break;
+            }
+            if (child & LEAF) {
+                int cmp = memcmp(accessLeaf(child).bytes.data(), bytes, traits::size);
+                if (cmp > 0 || (cmp == 0 && inclusive)) {
+                    return child;
+                }
+                break;
+            }
+            node = child;
+            level++;
+        }
+
+        // Every key in a following slot is past the key, the closest one is the smallest key of the first such subtree
+        for (size_t l = level + 1; l-- > 0;) {
+            const auto& children = nodes[path[l]].children;
+            for (size_t i = indexAt(bytes, l) + 1; i < FANOUT; i++) {
+                if (children[i] != NO_CHILD) {
+                    Cursor cursor;
+                    return descend(children[i], 0, cursor, true);
+                }
+            }
+        }
+
+        return NO_CHILD;
+    }
+
+    bool eraseBelow(uint32_t node, size_t level, const KeyBytes& bytes) {
+        // Inner nodes end above the last level, the last nibble always selects a leaf
+        if (level == LEVELS) {
+            return false;
+        }
+
+        size_t index = indexAt(bytes.data(), level);
+        uint32_t child = nodes[node].children[index];
+        if (child == NO_CHILD) {
+            return false;
+        }
+
+        if (child & LEAF) {
+            if (accessLeaf(child).bytes != bytes) {
+                return false;
+            }
+            nodes[node].children[index] = NO_CHILD;
+            releaseLeaf(child);
+            return true;
+        }
+
+        if (!eraseBelow(child, level + 1, bytes)) {
+            return false;
+        }
+
+        // Drop the emptied node, or pull a single remaining leaf up into its slot
+        uint32_t single = NO_CHILD;
+        size_t present = 0;
+        for (auto grandChild : nodes[child].children) {
+            if (grandChild != NO_CHILD) {
+                present++;
+                single = grandChild;
+            }
+        }
+
+        if (present == 0 || (present == 1 && (single & LEAF))) {
+            nodes[node].children[index] = single;
+            freeNodes.push_back(child);
+            version++;
+        }
+        return true;
+    }
+};
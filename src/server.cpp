@@ -3,7 +3,10 @@
 //
 
 #include "server.h"
+#include "server_ext.h"
+#include <algorithm>
 #include <iostream>
+#include <thread>
 #include "MemDB.h"
 
 
@@ -214,3 +217,486 @@ ErrCode insertRecord(IdxState *idxState, TxnState *txn, Key *k, const char* payl
 ErrCode deleteRecord(IdxState *idxState, TxnState *txn, Record *record) {
     return db.deleteRecord(idxState, txn, record);
 }
+
+/**
+ Rebuilds the inner nodes of an index in depth-first order, so that the
+ nodes of a lookup path are close to each other in memory.
+
+ The nodes are copied in chunks, the index latch is released between them.
+ Other threads can keep using the index while this runs on a background
+ thread, they are only held up for a chunk at a time. Inserts and deletes
+ of keys that add or remove nodes in the meantime make the copy stale, it is
+ then started over. Under a steady load of such writes the call fails.
+
+ @param idxState The state variable for the index to compact
+ @return ErrCode
+ SUCCESS if the index was compacted.
+ FAILURE if concurrent writers kept changing the index structure, the call
+ may be retried once the index is quieter.
+ */
+ErrCode compactIndex(IdxState *idxState) {
+    return db.compactIndex(idxState);
+}
+
+/**
+ Inserts a batch of records in one call. The records do not need to be
+ sorted, a batch that is already sorted by key skips the sort.
+
+ If the index is empty, the trie is built directly from the sorted batch
+ instead of inserting record by record. Otherwise all records are inserted
+ under a single acquisition of the index latch. Like insertRecord outside
+ of a transaction, the records are committed immediately.
+
+ @param idxState The state variable for this thread
+ @param records Array of records to insert
+ @param count Number of records in the array
+ @return ErrCode
+ SUCCESS if all records were inserted. Records whose key/payload pair already
+ exists (in the index or earlier in the batch) are skipped.
+ FAILURE if the records could not be inserted for some other reason.
+ */
+ErrCode bulkLoad(IdxState *idxState, const Record *records, size_t count) {
+    return db.bulkLoad(idxState, records, count, 1);
+}
+
+/**
+ Same as bulkLoad, but sorts the batch and builds the subtrees below the
+ common prefix of its keys on multiple threads.
+
+ @param idxState The state variable for this thread
+ @param records Array of records to insert
+ @param count Number of records in the array
+ @param threads Number of threads to use, 0 uses one thread per core
+ @return ErrCode
+ SUCCESS if all records were inserted. Records whose key/payload pair already
+ exists (in the index or earlier in the batch) are skipped.
+ FAILURE if the records could not be inserted for some other reason.
+ */
+ErrCode bulkLoadParallel(IdxState *idxState, const Record *records, size_t count, unsigned threads) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    return db.bulkLoad(idxState, records, count, threads);
+}
+
+/**
+ Looks up many keys at once, with the same result per key as a call of get
+ for each of them in order.
+
+ The lookups advance through the index in lockstep, so that the memory
+ accesses of different keys overlap. The index latch is only taken once.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param records Records containing the keys being retrieved, into which the
+ payloads are copied.
+ @param count Number of records
+ @param results Receives the result of get for every record (SUCCESS or KEY_NOTFOUND)
+ @return ErrCode
+ SUCCESS if all keys were looked up.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the keys could not be looked up for some other reason.
+ */
+ErrCode getBatch(IdxState *idxState, TxnState *txn, Record *records, size_t count, ErrCode *results) {
+    return db.getBatch(idxState, txn, records, count, results);
+}
+
+/**
+ Retrieves the next records of the index, like up to count calls of
+ getNext, but under a single acquisition of the index latch.
+
+ Within a transaction the scan continues at, and advances, the cursor that
+ get and getNext use. Without a transaction every call scans from the
+ smallest key.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param records Array of at least count records that receive the keys and
+ payloads
+ @param count Maximum number of records to retrieve
+ @param produced Receives the number of records retrieved
+ @return ErrCode
+ SUCCESS if at least one record was retrieved.
+ DB_END if there were no more records to retrieve.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the records could not be retrieved for some other reason.
+ */
+ErrCode getNextBatch(IdxState *idxState, TxnState *txn, Record *records, size_t count, size_t *produced) {
+    return db.getNextBatch(idxState, txn, records, count, produced);
+}
+
+/**
+ Positions the cursor of a transaction on the first record within a key
+ range. The following getNext and getNextBatch calls return the records of
+ the range in order. Once the next key is past the upper bound or the end of
+ the index is reached, they return DB_END until the cursor is positioned
+ again.
+
+ The range ends with the next get on the same index, which positions the
+ cursor by key again.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state, a cursor only exists within a
+ transaction
+ @param range The range of keys to scan
+ @return ErrCode
+ SUCCESS if the cursor was positioned.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if txn is NULL or the cursor could not be positioned for some
+ other reason.
+ */
+ErrCode seekRange(IdxState *idxState, TxnState *txn, const KeyRange *range) {
+    return db.seekRange(idxState, txn, range);
+}
+
+/**
+ Retrieves the first records within a key range, like seekRange followed
+ by getNextBatch.
+
+ Within a transaction the cursor stays behind the last retrieved record,
+ so that getNext and getNextBatch continue the range. Without a
+ transaction only the first count records of the range can be retrieved.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param range The range of keys to scan
+ @param records Array of at least count records that receive the keys and
+ payloads
+ @param count Maximum number of records to retrieve
+ @param produced Receives the number of records retrieved
+ @return ErrCode
+ SUCCESS if at least one record was retrieved.
+ DB_END if there are no records within the range.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the records could not be retrieved for some other reason.
+ */
+ErrCode scanRange(IdxState *idxState, TxnState *txn, const KeyRange *range, Record *records, size_t count, size_t *produced) {
+    return db.scanRange(idxState, txn, range, records, count, produced);
+}
+
+/**
+ Retrieves the previous record of the cursor of a transaction, the mirror
+ image of getNext. Records are returned in descending order by key.
+
+ Within a transaction getPrev continues from the record the last getNext
+ or getPrev returned, or behind the key of the last get. The first call of
+ a transaction starts at the largest key. Without a transaction it always
+ returns a record with the largest key.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param record Record receiving the key and payload
+ @return ErrCode
+ SUCCESS if a record was retrieved.
+ DB_END if there are no records before the cursor.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the record could not be retrieved for some other reason.
+ */
+ErrCode getPrev(IdxState *idxState, TxnState *txn, Record *record) {
+    return db.getPrev(idxState, txn, record);
+}
+
+/**
+ Positions the cursor of a transaction on the last record within a key
+ range. The following getPrev calls return the records of the range in
+ descending order, and DB_END once the next key is before the lower bound
+ or the start of the index is reached, until the cursor is positioned
+ again.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state, a cursor only exists within a
+ transaction
+ @param range The range of keys to scan
+ @return ErrCode
+ SUCCESS if the cursor was positioned.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if txn is NULL or the cursor could not be positioned for some
+ other reason.
+ */
+ErrCode seekRangeDescending(IdxState *idxState, TxnState *txn, const KeyRange *range) {
+    return db.seekRangeDescending(idxState, txn, range);
+}
+
+/**
+ Retrieves the last records within a key range in descending order, like
+ seekRangeDescending followed by getPrev calls. With an unbounded range
+ this returns the records with the largest keys.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param range The range of keys to scan
+ @param records Array of at least count records that receive the keys and
+ payloads
+ @param count Maximum number of records to retrieve
+ @param produced Receives the number of records retrieved
+ @return ErrCode
+ SUCCESS if at least one record was retrieved.
+ DB_END if there are no records within the range.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the records could not be retrieved for some other reason.
+ */
+ErrCode scanRangeDescending(IdxState *idxState, TxnState *txn, const KeyRange *range, Record *records, size_t count, size_t *produced) {
+    return db.scanRangeDescending(idxState, txn, range, records, count, produced);
+}
+
+/**
+ Creates a new index like create, with the given options.
+
+ @param type The type of the keys in this index
+ @param name The name of the index
+ @param options The options of the index, NULL selects the defaults
+ @return ErrCode
+ SUCCESS if the index was created successfully
+ DB_EXISTS if an index already exists with the given name
+ FAILURE if an error occurs for some other reason
+ */
+ErrCode createWithOptions(KeyType type, char *name, const IndexOptions *options) {
+    return db.createWithOptions(type, name, options ? *options : IndexOptions {});
+}
+
+/**
+ Counts the keys within a key range, without scanning them. Every key is
+ counted once, regardless of the number of payloads stored under it, and
+ keys inserted by transactions that did not commit yet are included.
+
+ @param idxState The state variable for this thread
+ @param range The range of keys to count
+ @param count Receives the number of keys
+ @return ErrCode
+ SUCCESS if the keys were counted.
+ FAILURE if the index does not maintain subtree counts.
+ */
+ErrCode countRange(IdxState *idxState, const KeyRange *range, size_t *count) {
+    return db.countRange(idxState, range, count);
+}
+
+/**
+ Determines the number of keys smaller than a key, the position the key
+ has or would have in a scan of the index. Counts like countRange.
+
+ @param idxState The state variable for this thread
+ @param key The key to determine the rank of, it does not need to exist
+ @param rank Receives the number of smaller keys
+ @return ErrCode
+ SUCCESS if the rank was determined.
+ FAILURE if the index does not maintain subtree counts.
+ */
+ErrCode rankOfKey(IdxState *idxState, const Key *key, size_t *rank) {
+    return db.rankOfKey(idxState, key, rank);
+}
+
+/**
+ Retrieves the key at a position of a scan of the index, with the position
+ counted from 0 and like in countRange.
+
+ @param idxState The state variable for this thread
+ @param rank The number of keys in front of the key
+ @param key Receives the key
+ @return ErrCode
+ SUCCESS if the key was retrieved.
+ KEY_NOTFOUND if the index has no more than rank keys.
+ FAILURE if the index does not maintain subtree counts.
+ */
+ErrCode selectKey(IdxState *idxState, size_t rank, Key *key) {
+    return db.selectKey(idxState, rank, key);
+}
+
+/**
+ Retrieves the first records whose keys start with a prefix, in ascending
+ order. Like scanRange, the cursor of a transaction stays within the
+ matching keys, so getNext and getNextBatch continue the scan.
+
+ The scan descends directly to the subtree of the prefix, the index has to
+ be a VARCHAR index created with leftAlignedVarchar.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param prefix Null-terminated prefix of the keys, an empty prefix matches
+ every key
+ @param records Array of at least count records that receive the keys and
+ payloads
+ @param count Maximum number of records to retrieve
+ @param produced Receives the number of records retrieved
+ @return ErrCode
+ SUCCESS if at least one record was retrieved.
+ DB_END if no key starts with the prefix.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the index does not use left-aligned VARCHAR keys or the records
+ could not be retrieved for some other reason.
+ */
+ErrCode prefixScan(IdxState *idxState, TxnState *txn, const char *prefix, Record *records, size_t count, size_t *produced) {
+    return db.prefixScan(idxState, txn, prefix, records, count, produced);
+}
+
+/**
+ Replaces the payload of a key/payload pair in place. The key is looked up
+ once and the entry keeps its position, unlike a deleteRecord followed by
+ an insertRecord.
+
+ Within a transaction the new payload is only visible to the transaction
+ until it commits, abortTransaction restores the old payload. Outside of a
+ transaction the update is committed immediately.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param k key value of the record
+ @param oldPayload Payload of the record to update
+ @param newPayload The payload replacing oldPayload
+ @return ErrCode
+ SUCCESS if the payload was replaced.
+ KEY_NOTFOUND if the key could not be found in the DB.
+ ENTRY_DNE if the key/oldPayload pair could not be found in the DB.
+ ENTRY_EXISTS if the key/newPayload pair already exists in the DB.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the record could not be updated for some other reason.
+ */
+ErrCode updateRecord(IdxState *idxState, TxnState *txn, Key *k, const char *oldPayload, const char *newPayload) {
+    return db.updateRecord(idxState, txn, k, oldPayload, newPayload);
+}
+
+/**
+ Same as updateRecord, but inserts the key/newPayload pair if the
+ key/oldPayload pair does not exist.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param k key value of the record
+ @param oldPayload Payload of the record to update
+ @param newPayload The payload replacing oldPayload or to insert
+ @return ErrCode
+ SUCCESS if the payload was replaced or inserted.
+ ENTRY_EXISTS if the key/newPayload pair already exists in the DB.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the record could not be updated for some other reason.
+ */
+ErrCode upsertRecord(IdxState *idxState, TxnState *txn, Key *k, const char *oldPayload, const char *newPayload) {
+    return db.upsertRecord(idxState, txn, k, oldPayload, newPayload);
+}
+
+/**
+ Deletes all records whose keys lie within a range. Subtrees of the index
+ whose keys all lie within the range are detached as a whole, without
+ visiting their keys one by one.
+
+ The delete is not part of a transaction: the records are removed
+ immediately, and aborting a transaction does not bring them back.
+
+ @param idxState The state variable for this thread
+ @param range The keys to delete, compared like in scanRange
+ @param deleted Receives the number of deleted records, may be NULL
+ @return ErrCode
+ SUCCESS if the records in the range were deleted, also if there were none.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the records could not be deleted for some other reason.
+ */
+ErrCode deleteRange(IdxState *idxState, const KeyRange *range, size_t *deleted) {
+    return db.deleteRange(idxState, range, deleted);
+}
+
+/**
+ Deletes all records of an index in constant time. The index continues on
+ fresh, empty node arrays, the old ones are freed by the epoch reclamation
+ once no thread can read them anymore.
+
+ The cursors of all transactions on the index start over, and aborting a
+ transaction does not bring back records it inserted before.
+
+ @param idxState The state variable for this thread
+ @return ErrCode
+ SUCCESS if the index was truncated.
+ FAILURE if the index could not be truncated for some other reason.
+ */
+ErrCode truncateIndex(IdxState *idxState) {
+    return db.truncateIndex(idxState);
+}
+
+/**
+ Inserts a row id under a key of an index created with rowIdPayloads. The
+ row id takes the place of the payload of insertRecord, it is stored as a
+ 64 bit integer instead of a string.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param k The key to insert
+ @param rowId The row id to store under the key
+ @return ErrCode
+ SUCCESS if the row id was inserted.
+ ENTRY_EXISTS if the key/row id pair already exists in the DB.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the index does not store row ids or for some other reason.
+ */
+ErrCode insertRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t rowId) {
+    return db.insertRowId(idxState, txn, k, rowId);
+}
+
+/**
+ Retrieves the first row id stored under a key of an index created with
+ rowIdPayloads. Like get, it positions the cursor for getNextRowId.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param k The key to look up
+ @param rowId Receives the row id
+ @return ErrCode
+ SUCCESS if a row id was found.
+ KEY_NOTFOUND if the key was not found in the DB.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the index does not store row ids or for some other reason.
+ */
+ErrCode getRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t *rowId) {
+    return db.getRowId(idxState, txn, k, rowId);
+}
+
+/**
+ Retrieves the next key/row id pair of an index created with rowIdPayloads,
+ in the order of getNext.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param k Receives the key
+ @param rowId Receives the row id
+ @return ErrCode
+ SUCCESS if a pair was found.
+ DB_END if there are no more pairs.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the index does not store row ids or for some other reason.
+ */
+ErrCode getNextRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t *rowId) {
+    return db.getNextRowId(idxState, txn, k, rowId);
+}
+
+/**
+ Deletes a key/row id pair of an index created with rowIdPayloads. To delete
+ all row ids of a key, use deleteRecord with an empty payload. The delete is
+ not undone when the transaction is aborted.
+
+ @param idxState The state variable for this thread
+ @param txn The transaction state to be used (or NULL if not in a transaction)
+ @param k The key of the pair
+ @param rowId The row id of the pair
+ @return ErrCode
+ SUCCESS if the pair was deleted.
+ KEY_NOTFOUND if the key was not found in the DB.
+ ENTRY_DNE if the key/row id pair does not exist in the DB.
+ DEADLOCK if this call could not complete because of deadlock.
+ FAILURE if the index does not store row ids or for some other reason.
+ */
+ErrCode deleteRowId(IdxState *idxState, TxnState *txn, Key *k, uint64_t rowId) {
+    return db.deleteRowId(idxState, txn, k, rowId);
+}
+
+/**
+ Returns counters of the internal state of an index, for tuning and
+ monitoring. The counters are read under the index latch, so they are
+ consistent with each other.
+
+ @param idxState The state variable for this thread
+ @param stats The statistics are copied into this struct
+ @return ErrCode
+ SUCCESS if the statistics were copied.
+ FAILURE if an error occurs.
+ */
+ErrCode getIndexStatistics(IdxState *idxState, IndexStatistics *stats) {
+    return db.getIndexStatistics(idxState, stats);
+}
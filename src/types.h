@@ -76,35 +76,91 @@ constexpr size_t max_levels() {
 
 class MemDB;
 class Tree;
+struct EpochParticipant;
+
+// Path of the last point lookup of an IdxState. The next lookup starts at the deepest L0 item the two keys share,
+// as long as the tree did not change in between.
+struct LookupFinger {
+    std::array<uint8_t, max_size()> keyData {};
+    std::array<offset, max_levels()> path {};
+    uint32_t depth = 0;
+    uint64_t version = 0;
+};
 
 struct IdxState {
     Tree* tree;
+    EpochParticipant* epoch;
+    LookupFinger finger;
+};
+
+// Key of a RecordView, SHORT and INT keys are held by value, VARCHAR keys point into the index like the payload
+struct KeyView {
+    KeyType type;
+    int64_t intkey;
+    std::string_view charkey;
+};
+
+// A record read through a ReadGuard, it points into the index and stays valid as long as the guard
+struct RecordView {
+    KeyView key;
+    std::string_view payload;
 };
 
 struct TxnState {
-    explicit TxnState(uint32_t txnId): transactionId(txnId), firstCall(true), traversalTrace({}) {
+    explicit TxnState(uint32_t txnId): transactionId(txnId) {
 
     }
 
     uint32_t transactionId;
-    bool firstCall;
-    std::array<uint8_t, max_levels()> traversalTrace;
 };
 
 enum class RecursiveDeleteResult {
     ONE_DELETED,
+    KEY_DELETED,
     ALL_DELETED,
     ENTRY_NOT_FOUND,
     KEY_NOT_FOUND
 };
 
 struct ReadPosition {
-    ReadPosition(): l1Offset(NO_CHILD), l2Iterator({}), hasMoreL2Items(false) {
+    ReadPosition(): l1Offset(NO_CHILD), l2Iterator({}), hasMoreL2Items(false), firstCall(true), descending(false),
+                    exhausted(false), traversalTrace({}), path({}), pathDepth(0), pathVersion(0), seekPending(false),
+                    anchorKey({}), anchorInclusive(false), ranged(false), bounded(false), boundInclusive(false), rangeEnded(false), bound({}),
+                    rowIdIndex(0) {
 
     }
 
     offset l1Offset;
     std::list<L2Item>::iterator l2Iterator;
     bool hasMoreL2Items;
+
+    // Scan cursor within one index, a transaction has one per index it reads
+    bool firstCall;
+    bool descending;
+    bool exhausted;
+    std::array<uint8_t, max_levels()> traversalTrace;
+
+    // L0 items along the trace, valid up to pathDepth while the tree is at pathVersion
+    std::array<offset, max_levels()> path;
+    uint32_t pathDepth;
+    uint64_t pathVersion;
+
+    // Key of the last get or of the last returned record, the trace is only positioned behind it when the scan goes on.
+    // A structural change of the tree invalidates the trace, it is then positioned again from here. Before the first
+    // record of a range scan it is the start of the range, which is part of the scan if inclusive.
+    bool seekPending;
+    std::array<uint8_t, max_size()> anchorKey;
+    bool anchorInclusive;
+
+    // Range scan positioned by a seek, it ends for good at the end of the index or in front of the first key past the
+    // bound
+    bool ranged;
+    bool bounded;
+    bool boundInclusive;
+    bool rangeEnded;
+    std::array<uint8_t, max_size()> bound;
+
+    // Counterpart of l2Iterator in an index with row id payloads, the index behind the last returned row id
+    uint32_t rowIdIndex;
 };
 
@@ -0,0 +1,122 @@
+//
+// Created by lukas on 19.10.26.
+//
+// Measures cache misses per lookup before and after compactIndex().
+// Usage: ./compaction_bench [keys] [lookups]
+//
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "server_ext.h"
+
+static int openCacheMissCounter() {
+    perf_event_attr attr {};
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static void runLookups(IdxState* state, const std::vector<int64_t>& keys, size_t lookups, int counter, const char* label) {
+    std::mt19937_64 rng(1468);
+    Record r;
+    r.key.type = INT;
+
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    auto start = std::chrono::steady_clock::now();
+
+    for (size_t i = 0; i < lookups; i++) {
+        r.key.keyval.intkey = keys[rng() % keys.size()];
+        get(state, nullptr, &r);
+    }
+
+    auto end = std::chrono::steady_clock::now();
+    uint64_t misses = 0;
+    if (counter >= 0) {
+        ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = 0;
+        }
+    }
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+    printf("%s: %.1f ns/lookup", label, (double) ns / lookups);
+    if (counter >= 0) {
+        printf(", %.2f cache misses/lookup", (double) misses / lookups);
+    }
+    printf("\n");
+}
+
+int main(int argc, char** argv) {
+    size_t numKeys = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t lookups = argc > 2 ? strtoul(argv[2], nullptr, 10) : 2000000;
+
+    char name[] = "compaction";
+    create(INT, name);
+    IdxState* state = nullptr;
+    openIndex(name, &state);
+
+    // Insert and delete in rounds, so that the nodes of a path end up far apart
+    std::mt19937_64 rng(42);
+    std::vector<int64_t> keys;
+    Key k;
+    k.type = INT;
+    Record r;
+    r.key.type = INT;
+    r.payload[0] = 0;
+    while (keys.size() < numKeys) {
+        for (int i = 0; i < 1000; i++) {
+            k.keyval.intkey = (int64_t) (rng() >> 1);
+            if (insertRecord(state, nullptr, &k, "payload") == SUCCESS) {
+                keys.push_back(k.keyval.intkey);
+            }
+        }
+        for (int i = 0; i < 100 && !keys.empty(); i++) {
+            size_t victim = rng() % keys.size();
+            r.key.keyval.intkey = keys[victim];
+            deleteRecord(state, nullptr, &r);
+            keys[victim] = keys.back();
+            keys.pop_back();
+        }
+    }
+
+    int counter = openCacheMissCounter();
+    if (counter < 0) {
+        printf("hardware cache miss counter not available, reporting time only\n");
+    }
+
+    runLookups(state, keys, lookups, counter, "before compaction");
+
+    auto start = std::chrono::steady_clock::now();
+    ErrCode result = compactIndex(state);
+    auto end = std::chrono::steady_clock::now();
+    printf("compactIndex: %s in %ld ms\n", result == SUCCESS ? "SUCCESS" : "FAILURE",
+           (long) std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count());
+
+    runLookups(state, keys, lookups, counter, "after compaction");
+
+    if (counter >= 0) {
+        close(counter);
+    }
+    closeIndex(state);
+    drop(name);
+    return 0;
+}
@@ -3,8 +3,18 @@
 #include "MemDB.h"
 #include <string>
 #include <string.h>
+#include <atomic>
+#include <thread>
+#include <set>
+#include <algorithm>
 #include "bitutils.h"
 #include "types.h"
+#include "Tree.h"
+#include "Epoch.h"
+#include "Index.h"
+#include "prefix_tree.h"
+#include <map>
+#include <random>
 
 TEST_CASE( "Basic create/drop tests", "[create]" ) {
     MemDB db;
@@ -539,4 +549,2256 @@ TEST_CASE( "footest?!?", "[foo]" ) {
     REQUIRE(db.commitTransaction(txn) == SUCCESS);
     REQUIRE(db.closeIndex(state) == SUCCESS);
     REQUIRE(db.drop((char*) "hello") == SUCCESS);
-}
\ No newline at end of file
+}
+
+TEST_CASE( "Reinsert after delete", "[delete]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "hello") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("hello", &state) == SUCCESS);
+
+    Key k;
+    k.type = INT;
+    k.keyval.intkey = 1;
+    REQUIRE(db.insertRecord(state, nullptr, &k, "payload1") == SUCCESS);
+
+    Record r;
+    r.key = k;
+    r.payload[0] = 0;
+
+    SECTION("delete of a different key sharing the slot") {
+        r.key.keyval.intkey = 2;
+        REQUIRE(db.deleteRecord(state, nullptr, &r) == KEY_NOTFOUND);
+
+        r.key.keyval.intkey = 1;
+        REQUIRE(db.get(state, nullptr, &r) == SUCCESS);
+    }
+
+    SECTION("reinsert same key") {
+        REQUIRE(db.deleteRecord(state, nullptr, &r) == SUCCESS);
+        REQUIRE(db.insertRecord(state, nullptr, &k, "payload2") == SUCCESS);
+        REQUIRE(db.get(state, nullptr, &r) == SUCCESS);
+        REQUIRE("payload2" == std::string(r.payload));
+    }
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+    REQUIRE(db.drop((char*) "hello") == SUCCESS);
+}
+
+TEST_CASE( "Insert/delete churn reuses nodes", "[delete]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "hello") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("hello", &state) == SUCCESS);
+
+    auto churn = [&](int64_t base) {
+        Key k;
+        k.type = INT;
+        for (int64_t i = 0; i < 1000; i++) {
+            k.keyval.intkey = base + i * 7919;
+            REQUIRE(db.insertRecord(state, nullptr, &k, "payload") == SUCCESS);
+        }
+
+        Record r;
+        r.key.type = INT;
+        r.payload[0] = 0;
+        for (int64_t i = 0; i < 1000; i++) {
+            r.key.keyval.intkey = base + i * 7919;
+            REQUIRE(db.deleteRecord(state, nullptr, &r) == SUCCESS);
+        }
+    };
+
+    churn(0);
+    auto before = state->tree->statistics();
+
+    for (int round = 0; round < 10; round++) {
+        churn(0);
+    }
+
+    auto after = state->tree->statistics();
+    REQUIRE(after.l0Items == before.l0Items);
+    REQUIRE(after.l1Items == before.l1Items);
+    REQUIRE(after.freeL0Items + after.retiredL0Items == after.l0Items - 1);
+    REQUIRE(after.freeL1Items + after.retiredL1Items == after.l1Items - 1);
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+    REQUIRE(db.drop((char*) "hello") == SUCCESS);
+}
+
+TEST_CASE( "Deletes collapse single-child chains", "[delete]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "hello") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("hello", &state) == SUCCESS);
+
+    auto liveL0Items = [&]() {
+        auto stats = state->tree->statistics();
+        return stats.l0Items - stats.freeL0Items - stats.retiredL0Items;
+    };
+
+    Key k;
+    k.type = INT;
+    k.keyval.intkey = 0;
+    REQUIRE(db.insertRecord(state, nullptr, &k, "payload1") == SUCCESS);
+    k.keyval.intkey = 1;
+    REQUIRE(db.insertRecord(state, nullptr, &k, "payload2") == SUCCESS);
+    k.keyval.intkey = 0x100;
+    REQUIRE(db.insertRecord(state, nullptr, &k, "payload3") == SUCCESS);
+
+    // root plus the chain down to the nibble where 0, 1 and 0x100 diverge
+    REQUIRE(liveL0Items() == 16);
+
+    Record r;
+    r.key.type = INT;
+    r.payload[0] = 0;
+
+    r.key.keyval.intkey = 1;
+    REQUIRE(db.deleteRecord(state, nullptr, &r) == SUCCESS);
+    REQUIRE(liveL0Items() == 14);
+
+    r.key.keyval.intkey = 0x100;
+    REQUIRE(db.deleteRecord(state, nullptr, &r) == SUCCESS);
+    REQUIRE(liveL0Items() == 1);
+
+    r.key.keyval.intkey = 0;
+    REQUIRE(db.get(state, nullptr, &r) == SUCCESS);
+    REQUIRE("payload1" == std::string(r.payload));
+    REQUIRE(db.getNext(state, nullptr, &r) == SUCCESS);
+    REQUIRE(r.key.keyval.intkey == 0);
+
+    k.keyval.intkey = 1;
+    REQUIRE(db.insertRecord(state, nullptr, &k, "payload2") == SUCCESS);
+    r.key.keyval.intkey = 1;
+    REQUIRE(db.get(state, nullptr, &r) == SUCCESS);
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+    REQUIRE(db.drop((char*) "hello") == SUCCESS);
+}
+
+TEST_CASE( "Epoch reclamation defers frees while readers are active", "[epoch]" ) {
+    EpochManager manager;
+    std::atomic<int*> shared {new int(42)};
+    std::atomic<bool> done {false};
+
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 3; t++) {
+        readers.emplace_back([&]() {
+            auto participant = manager.registerThread();
+            while (!done) {
+                EpochGuard guard(manager, participant);
+                int* value = shared.load();
+                // A premature free shows up as a heap-use-after-free under ASan
+                if (*value != 42) {
+                    abort();
+                }
+            }
+            manager.unregisterThread(participant);
+        });
+    }
+
+    auto writer = manager.registerThread();
+    for (int i = 0; i < 10000; i++) {
+        EpochGuard guard(manager, writer);
+        int* old = shared.exchange(new int(42));
+        manager.retire([=]() {
+            *old = 0;
+            delete old;
+        });
+    }
+    manager.unregisterThread(writer);
+
+    done = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+
+    manager.reclaim();
+    REQUIRE(manager.pendingRetirements() == 0);
+    delete shared.load();
+}
+
+TEST_CASE( "Concurrent deletes and scans", "[epoch]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "hello") == SUCCESS);
+
+    {
+        IdxState* state = nullptr;
+        REQUIRE(db.openIndex("hello", &state) == SUCCESS);
+        Key k;
+        k.type = INT;
+        for (int64_t i = 0; i < 2000; i++) {
+            k.keyval.intkey = i * 31;
+            REQUIRE(db.insertRecord(state, nullptr, &k, "payload") == SUCCESS);
+        }
+        REQUIRE(db.closeIndex(state) == SUCCESS);
+    }
+
+    std::atomic<bool> done {false};
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&, t]() {
+            IdxState* state = nullptr;
+            db.openIndex("hello", &state);
+
+            Key k;
+            k.type = INT;
+            Record r;
+            r.key.type = INT;
+            r.payload[0] = 0;
+            for (int round = 0; round < 20; round++) {
+                for (int64_t i = t; i < 2000; i += 2) {
+                    r.key.keyval.intkey = i * 31;
+                    db.deleteRecord(state, nullptr, &r);
+                }
+                for (int64_t i = t; i < 2000; i += 2) {
+                    k.keyval.intkey = i * 31;
+                    db.insertRecord(state, nullptr, &k, "payload");
+                }
+            }
+
+            db.closeIndex(state);
+        });
+    }
+
+    for (int t = 0; t < 2; t++) {
+        threads.emplace_back([&]() {
+            IdxState* state = nullptr;
+            db.openIndex("hello", &state);
+
+            Record r;
+            while (!done) {
+                TxnState* txn = nullptr;
+                db.beginTransaction(&txn);
+                int64_t last = INT64_MIN;
+                while (db.getNext(state, txn, &r) == SUCCESS) {
+                    if (r.key.keyval.intkey < last) {
+                        abort();
+                    }
+                    last = r.key.keyval.intkey;
+                }
+                db.commitTransaction(txn);
+            }
+
+            db.closeIndex(state);
+        });
+    }
+
+    threads[0].join();
+    threads[1].join();
+    done = true;
+    threads[2].join();
+    threads[3].join();
+
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("hello", &state) == SUCCESS);
+    Record r;
+    r.key.type = INT;
+    for (int64_t i = 0; i < 2000; i++) {
+        r.key.keyval.intkey = i * 31;
+        REQUIRE(db.get(state, nullptr, &r) == SUCCESS);
+    }
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+    REQUIRE(db.drop((char*) "hello") == SUCCESS);
+}
+
+TEST_CASE( "Compaction keeps all keys and drops free nodes", "[compact]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "hello") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("hello", &state) == SUCCESS);
+
+    Key k;
+    k.type = INT;
+    for (int64_t i = 0; i < 5000; i++) {
+        k.keyval.intkey = i * 104729;
+        REQUIRE(db.insertRecord(state, nullptr, &k, "payload") == SUCCESS);
+    }
+
+    Record r;
+    r.key.type = INT;
+    r.payload[0] = 0;
+    for (int64_t i = 0; i < 5000; i += 2) {
+        r.key.keyval.intkey = i * 104729;
+        REQUIRE(db.deleteRecord(state, nullptr, &r) == SUCCESS);
+    }
+
+    auto before = state->tree->statistics();
+    REQUIRE(db.compactIndex(state) == SUCCESS);
+    auto after = state->tree->statistics();
+
+    REQUIRE(after.freeL0Items == 0);
+    REQUIRE(after.retiredL0Items == 0);
+    REQUIRE(after.l0Items == before.l0Items - before.freeL0Items - before.retiredL0Items);
+
+    for (int64_t i = 0; i < 5000; i++) {
+        r.key.keyval.intkey = i * 104729;
+        REQUIRE(db.get(state, nullptr, &r) == (i % 2 ? SUCCESS : KEY_NOTFOUND));
+    }
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    for (int64_t i = 1; i < 5000; i += 2) {
+        REQUIRE(db.getNext(state, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == i * 104729);
+    }
+    REQUIRE(db.getNext(state, txn, &r) == DB_END);
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+    SECTION("compaction concurrent to inserts") {
+        std::thread writer([&]() {
+            IdxState* writerState = nullptr;
+            db.openIndex("hello", &writerState);
+            Key key;
+            key.type = INT;
+            for (int64_t i = 0; i < 5000; i += 2) {
+                key.keyval.intkey = i * 104729;
+                db.insertRecord(writerState, nullptr, &key, "payload");
+            }
+            db.closeIndex(writerState);
+        });
+
+        for (int i = 0; i < 20; i++) {
+            db.compactIndex(state);
+        }
+        writer.join();
+
+        for (int64_t i = 0; i < 5000; i++) {
+            r.key.keyval.intkey = i * 104729;
+            REQUIRE(db.get(state, nullptr, &r) == SUCCESS);
+        }
+    }
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+    REQUIRE(db.drop((char*) "hello") == SUCCESS);
+}
+
+TEST_CASE( "Bulk load builds the same trie as single inserts", "[bulk]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "bulk") == SUCCESS);
+    REQUIRE(db.create(INT, (char*) "single") == SUCCESS);
+    IdxState* bulk = nullptr;
+    IdxState* single = nullptr;
+    REQUIRE(db.openIndex("bulk", &bulk) == SUCCESS);
+    REQUIRE(db.openIndex("single", &single) == SUCCESS);
+
+    std::vector<Record> records(3000);
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i].key.type = INT;
+        records[i].key.keyval.intkey = (int64_t) ((i * 7919) % 1000) * 104729;
+        snprintf(records[i].payload, MAX_PAYLOAD_LEN, "payload%zu", i % 1500);
+        db.insertRecord(single, nullptr, &records[i].key, records[i].payload);
+    }
+
+    SECTION("into an empty index") {
+        REQUIRE(db.bulkLoad(bulk, records.data(), records.size(), 1) == SUCCESS);
+
+        auto bulkStats = bulk->tree->statistics();
+        auto singleStats = single->tree->statistics();
+        REQUIRE(bulkStats.l0Items == singleStats.l0Items);
+        REQUIRE(bulkStats.l1Items == singleStats.l1Items);
+    }
+
+    SECTION("into an empty index with multiple threads") {
+        REQUIRE(db.bulkLoad(bulk, records.data(), records.size(), 4) == SUCCESS);
+
+        auto bulkStats = bulk->tree->statistics();
+        auto singleStats = single->tree->statistics();
+        REQUIRE(bulkStats.l0Items == singleStats.l0Items);
+        REQUIRE(bulkStats.l1Items == singleStats.l1Items);
+    }
+
+    SECTION("into a non-empty index") {
+        REQUIRE(db.bulkLoad(bulk, records.data(), 10, 1) == SUCCESS);
+        REQUIRE(db.bulkLoad(bulk, records.data(), records.size(), 1) == SUCCESS);
+    }
+
+    TxnState* singleTxn = nullptr;
+    TxnState* bulkTxn = nullptr;
+    REQUIRE(db.beginTransaction(&singleTxn) == SUCCESS);
+    REQUIRE(db.beginTransaction(&bulkTxn) == SUCCESS);
+    Record expected;
+    Record actual;
+    size_t count = 0;
+    while (db.getNext(single, singleTxn, &expected) == SUCCESS) {
+        REQUIRE(db.getNext(bulk, bulkTxn, &actual) == SUCCESS);
+        REQUIRE(actual.key.keyval.intkey == expected.key.keyval.intkey);
+        count++;
+    }
+    REQUIRE(db.getNext(bulk, bulkTxn, &actual) == DB_END);
+    REQUIRE(db.commitTransaction(singleTxn) == SUCCESS);
+    REQUIRE(db.commitTransaction(bulkTxn) == SUCCESS);
+    REQUIRE(count == 3000);
+
+    REQUIRE(db.closeIndex(bulk) == SUCCESS);
+    REQUIRE(db.closeIndex(single) == SUCCESS);
+}
+
+TEST_CASE( "Bulk load of varchar keys", "[bulk]" ) {
+    MemDB db;
+    REQUIRE(db.create(VARCHAR, (char*) "hello") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("hello", &state) == SUCCESS);
+
+    const char* keys[] = {"foo", "bar", "foobar", "baz", "foo", "a"};
+    std::vector<Record> records(6);
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i].key.type = VARCHAR;
+        strcpy(records[i].key.keyval.charkey, keys[i]);
+        snprintf(records[i].payload, MAX_PAYLOAD_LEN, "payload%zu", i);
+    }
+    REQUIRE(db.bulkLoad(state, records.data(), records.size(), 2) == SUCCESS);
+
+    // Right aligned varchars are ordered by length first
+    const char* expected[] = {"a", "bar", "baz", "foo", "foo", "foobar"};
+    Record r;
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    for (auto key : expected) {
+        REQUIRE(db.getNext(state, txn, &r) == SUCCESS);
+        REQUIRE(std::string(key) == r.key.keyval.charkey);
+    }
+    REQUIRE(db.getNext(state, txn, &r) == DB_END);
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Parallel bulk load of keys spread over all subtrees", "[bulk]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "bulk") == SUCCESS);
+    REQUIRE(db.create(INT, (char*) "single") == SUCCESS);
+    IdxState* bulk = nullptr;
+    IdxState* single = nullptr;
+    REQUIRE(db.openIndex("bulk", &bulk) == SUCCESS);
+    REQUIRE(db.openIndex("single", &single) == SUCCESS);
+
+    std::vector<Record> records(20000);
+    uint64_t value = 88172645463325252ull;
+    for (auto& record : records) {
+        // xorshift, covers every first key byte
+        value ^= value << 13;
+        value ^= value >> 7;
+        value ^= value << 17;
+        record.key.type = INT;
+        record.key.keyval.intkey = (int64_t) value;
+        strcpy(record.payload, "payload");
+        REQUIRE(db.insertRecord(single, nullptr, &record.key, record.payload) == SUCCESS);
+    }
+
+    REQUIRE(db.bulkLoad(bulk, records.data(), records.size(), 4) == SUCCESS);
+
+    auto bulkStats = bulk->tree->statistics();
+    auto singleStats = single->tree->statistics();
+    REQUIRE(bulkStats.l0Items == singleStats.l0Items);
+    REQUIRE(bulkStats.l1Items == singleStats.l1Items);
+
+    Record r;
+    for (const auto& record : records) {
+        r.key = record.key;
+        REQUIRE(db.get(bulk, nullptr, &r) == SUCCESS);
+    }
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    size_t count = 0;
+    uint64_t last = 0;
+    while (db.getNext(bulk, txn, &r) == SUCCESS) {
+        REQUIRE((uint64_t) r.key.keyval.intkey >= last);
+        last = r.key.keyval.intkey;
+        count++;
+    }
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+    REQUIRE(count == records.size());
+
+    REQUIRE(db.closeIndex(bulk) == SUCCESS);
+    REQUIRE(db.closeIndex(single) == SUCCESS);
+}
+
+TEST_CASE( "Parallel bulk load of dense keys", "[bulk]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "bulk") == SUCCESS);
+    REQUIRE(db.create(INT, (char*) "single") == SUCCESS);
+    IdxState* bulk = nullptr;
+    IdxState* single = nullptr;
+    REQUIRE(db.openIndex("bulk", &bulk) == SUCCESS);
+    REQUIRE(db.openIndex("single", &single) == SUCCESS);
+
+    // All keys share their first byte, the subtrees are split below the common prefix instead
+    std::vector<Record> records(100000);
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i].key.type = INT;
+        records[i].key.keyval.intkey = (int64_t) i;
+        strcpy(records[i].payload, "payload");
+        REQUIRE(db.insertRecord(single, nullptr, &records[i].key, records[i].payload) == SUCCESS);
+    }
+    std::shuffle(records.begin(), records.end(), std::mt19937(31));
+
+    REQUIRE(db.bulkLoad(bulk, records.data(), records.size(), 4) == SUCCESS);
+
+    auto bulkStats = bulk->tree->statistics();
+    auto singleStats = single->tree->statistics();
+    REQUIRE(bulkStats.bulkLoadTasks > 16);
+    REQUIRE(bulkStats.l0Items == singleStats.l0Items);
+    REQUIRE(bulkStats.l1Items == singleStats.l1Items);
+
+    Record r;
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    for (int64_t i = 0; i < (int64_t) records.size(); i++) {
+        REQUIRE(db.getNext(bulk, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == i);
+    }
+    REQUIRE(db.getNext(bulk, txn, &r) == DB_END);
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+    REQUIRE(db.closeIndex(bulk) == SUCCESS);
+    REQUIRE(db.closeIndex(single) == SUCCESS);
+}
+
+TEST_CASE( "Batched get matches single gets", "[batch]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "batch") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("batch", &state) == SUCCESS);
+
+    Key key;
+    key.type = INT;
+    for (int64_t i = 0; i < 5000; i += 2) {
+        key.keyval.intkey = i * 7919;
+        REQUIRE(db.insertRecord(state, nullptr, &key, (char*) std::to_string(i).c_str()) == SUCCESS);
+    }
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    key.keyval.intkey = 1 * 7919;
+    REQUIRE(db.insertRecord(state, txn, &key, (char*) "uncommitted") == SUCCESS);
+
+    std::vector<Record> records(1000);
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i].key.type = INT;
+        records[i].key.keyval.intkey = (int64_t) ((i * 13) % 5000) * 7919;
+    }
+    records[3].key.keyval.intkey = 7919;
+
+    SECTION( "without transaction" ) {
+        std::vector<ErrCode> results(records.size());
+        REQUIRE(db.getBatch(state, nullptr, records.data(), records.size(), results.data()) == SUCCESS);
+
+        Record r;
+        for (size_t i = 0; i < records.size(); i++) {
+            r.key = records[i].key;
+            REQUIRE(results[i] == db.get(state, nullptr, &r));
+            if (results[i] == SUCCESS) {
+                REQUIRE(std::string(records[i].payload) == r.payload);
+            }
+        }
+        REQUIRE(results[3] == KEY_NOTFOUND);
+    }
+
+    SECTION( "within transaction" ) {
+        std::vector<ErrCode> results(records.size());
+        REQUIRE(db.getBatch(state, txn, records.data(), records.size(), results.data()) == SUCCESS);
+        REQUIRE(results[3] == SUCCESS);
+        REQUIRE(std::string(records[3].payload) == "uncommitted");
+
+        Record r;
+        for (size_t i = 0; i < records.size(); i++) {
+            r.key = records[i].key;
+            REQUIRE(results[i] == db.get(state, txn, &r));
+        }
+    }
+
+    REQUIRE(db.abortTransaction(txn) == SUCCESS);
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Batched get on short keys matches single gets", "[batch]" ) {
+    MemDB db;
+    REQUIRE(db.create(SHORT, (char*) "batch") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("batch", &state) == SUCCESS);
+
+    Key key;
+    key.type = SHORT;
+    for (int32_t i = -3000; i < 3000; i += 3) {
+        key.keyval.shortkey = i * 101;
+        REQUIRE(db.insertRecord(state, nullptr, &key, (char*) std::to_string(i).c_str()) == SUCCESS);
+    }
+
+    // Odd sizes leave partially filled vectors and groups
+    std::vector<Record> records(997);
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i].key.type = SHORT;
+        records[i].key.keyval.shortkey = ((int32_t) i - 500) * 101;
+    }
+
+    std::vector<ErrCode> results(records.size());
+    REQUIRE(db.getBatch(state, nullptr, records.data(), records.size(), results.data()) == SUCCESS);
+
+    Record r;
+    size_t found = 0;
+    for (size_t i = 0; i < records.size(); i++) {
+        r.key = records[i].key;
+        REQUIRE(results[i] == db.get(state, nullptr, &r));
+        if (results[i] == SUCCESS) {
+            REQUIRE(std::string(records[i].payload) == r.payload);
+            found++;
+        }
+    }
+    REQUIRE(found == 332);
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Batched getNext continues the cursor of getNext", "[batch]" ) {
+    MemDB db;
+    REQUIRE(db.create(VARCHAR, (char*) "scan") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("scan", &state) == SUCCESS);
+
+    Key key;
+    key.type = VARCHAR;
+    std::vector<std::string> expected;
+    for (int i = 0; i < 3000; i++) {
+        std::string s = "key" + std::to_string(i * 37);
+        strcpy(key.keyval.charkey, s.c_str());
+        REQUIRE(db.insertRecord(state, nullptr, &key, (char*) "first") == SUCCESS);
+        if (i % 5 == 0) {
+            REQUIRE(db.insertRecord(state, nullptr, &key, (char*) "second") == SUCCESS);
+        }
+    }
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    Record r;
+    while (db.getNext(state, txn, &r) == SUCCESS) {
+        expected.push_back(std::string(r.key.keyval.charkey) + "/" + r.payload);
+    }
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+    REQUIRE(expected.size() == 3600);
+
+    SECTION( "mixed with getNext" ) {
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        std::vector<std::string> scanned;
+        std::vector<Record> records(97);
+        size_t produced = 0;
+        while (true) {
+            REQUIRE(db.getNext(state, txn, &r) == SUCCESS);
+            scanned.push_back(std::string(r.key.keyval.charkey) + "/" + r.payload);
+
+            ErrCode result = db.getNextBatch(state, txn, records.data(), records.size(), &produced);
+            for (size_t i = 0; i < produced; i++) {
+                scanned.push_back(std::string(records[i].key.keyval.charkey) + "/" + records[i].payload);
+            }
+            if (produced < records.size()) {
+                REQUIRE((result == DB_END) == (produced == 0));
+                break;
+            }
+        }
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+        REQUIRE(scanned == expected);
+    }
+
+    SECTION( "without transaction" ) {
+        std::vector<Record> records(10);
+        size_t produced = 0;
+        for (int round = 0; round < 2; round++) {
+            REQUIRE(db.getNextBatch(state, nullptr, records.data(), records.size(), &produced) == SUCCESS);
+            REQUIRE(produced == records.size());
+            for (size_t i = 0; i < produced; i++) {
+                REQUIRE(std::string(records[i].key.keyval.charkey) + "/" + records[i].payload == expected[i]);
+            }
+        }
+    }
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Interleaved scans of two indices in one transaction", "[batch]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "a") == SUCCESS);
+    REQUIRE(db.create(INT, (char*) "b") == SUCCESS);
+    IdxState* a = nullptr;
+    IdxState* b = nullptr;
+    REQUIRE(db.openIndex("a", &a) == SUCCESS);
+    REQUIRE(db.openIndex("b", &b) == SUCCESS);
+
+    Key key;
+    key.type = INT;
+    for (int64_t i = 0; i < 500; i++) {
+        key.keyval.intkey = i * 3;
+        REQUIRE(db.insertRecord(a, nullptr, &key, (char*) "a") == SUCCESS);
+        key.keyval.intkey = i * 5 + 100000;
+        REQUIRE(db.insertRecord(b, nullptr, &key, (char*) "b") == SUCCESS);
+    }
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    Record r;
+    for (int64_t i = 0; i < 500; i++) {
+        REQUIRE(db.getNext(a, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == i * 3);
+        REQUIRE(db.getNext(b, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == i * 5 + 100000);
+    }
+    REQUIRE(db.getNext(a, txn, &r) == DB_END);
+    REQUIRE(db.getNext(b, txn, &r) == DB_END);
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+    REQUIRE(db.closeIndex(a) == SUCCESS);
+    REQUIRE(db.closeIndex(b) == SUCCESS);
+}
+
+TEST_CASE( "Range scans seek to the lower bound and stop at the upper bound", "[range]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "range") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("range", &state) == SUCCESS);
+
+    Key key;
+    key.type = INT;
+    std::vector<int64_t> keys;
+    for (int64_t i = 0; i < 4000; i++) {
+        key.keyval.intkey = i * 10;
+        REQUIRE(db.insertRecord(state, nullptr, &key, (char*) "first") == SUCCESS);
+        keys.push_back(i * 10);
+        if (i % 5 == 0) {
+            REQUIRE(db.insertRecord(state, nullptr, &key, (char*) "second") == SUCCESS);
+            keys.push_back(i * 10);
+        }
+    }
+
+    struct Bounds { int64_t low; BoundType lowType; int64_t high; BoundType highType; };
+    std::vector<Bounds> ranges = {
+            {100, INCLUSIVE, 200, EXCLUSIVE},
+            {100, EXCLUSIVE, 200, INCLUSIVE},
+            {105, INCLUSIVE, 195, INCLUSIVE},
+            {0, UNBOUNDED, 55, EXCLUSIVE},
+            {39000, INCLUSIVE, 0, UNBOUNDED},
+            {39990, EXCLUSIVE, 0, UNBOUNDED},
+            {150, INCLUSIVE, 150, INCLUSIVE},
+            {150, EXCLUSIVE, 150, INCLUSIVE},
+            {159, INCLUSIVE, 161, EXCLUSIVE},
+            {255, INCLUSIVE, 38888, EXCLUSIVE},
+            {0, UNBOUNDED, 0, UNBOUNDED},
+    };
+
+    for (const auto& bounds : ranges) {
+        KeyRange range;
+        range.low.type = INT;
+        range.low.keyval.intkey = bounds.low;
+        range.lowType = bounds.lowType;
+        range.high.type = INT;
+        range.high.keyval.intkey = bounds.high;
+        range.highType = bounds.highType;
+
+        std::vector<int64_t> expected;
+        for (auto k : keys) {
+            bool aboveLow = bounds.lowType == UNBOUNDED || k > bounds.low || (k == bounds.low && bounds.lowType == INCLUSIVE);
+            bool belowHigh = bounds.highType == UNBOUNDED || k < bounds.high || (k == bounds.high && bounds.highType == INCLUSIVE);
+            if (aboveLow && belowHigh) {
+                expected.push_back(k);
+            }
+        }
+
+        TxnState* txn = nullptr;
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+
+        // scanRange, continued by getNextBatch
+        std::vector<Record> records(64);
+        size_t produced = 0;
+        std::vector<int64_t> scanned;
+        ErrCode result = db.scanRange(state, txn, &range, records.data(), records.size(), &produced);
+        while (result == SUCCESS) {
+            for (size_t i = 0; i < produced; i++) {
+                scanned.push_back(records[i].key.keyval.intkey);
+            }
+            result = db.getNextBatch(state, txn, records.data(), records.size(), &produced);
+        }
+        REQUIRE(result == DB_END);
+        REQUIRE(scanned == expected);
+
+        // seekRange, continued by getNext
+        scanned.clear();
+        Record r;
+        REQUIRE(db.seekRange(state, txn, &range) == SUCCESS);
+        while (db.getNext(state, txn, &r) == SUCCESS) {
+            scanned.push_back(r.key.keyval.intkey);
+        }
+        REQUIRE(scanned == expected);
+        REQUIRE(db.getNext(state, txn, &r) == DB_END);
+
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+        // Without a transaction only the first records can be retrieved
+        result = db.scanRange(state, nullptr, &range, records.data(), records.size(), &produced);
+        REQUIRE(produced == std::min(records.size(), expected.size()));
+        REQUIRE(result == (expected.empty() ? DB_END : SUCCESS));
+        for (size_t i = 0; i < produced; i++) {
+            REQUIRE(records[i].key.keyval.intkey == expected[i]);
+        }
+    }
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    REQUIRE(db.seekRange(state, nullptr, nullptr) == FAILURE);
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Descending scans with getPrev", "[range]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "desc") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("desc", &state) == SUCCESS);
+
+    Key key;
+    key.type = INT;
+    std::vector<int64_t> keys;
+    for (int64_t i = 0; i < 3000; i++) {
+        key.keyval.intkey = i * 10;
+        REQUIRE(db.insertRecord(state, nullptr, &key, (char*) "payload") == SUCCESS);
+        keys.push_back(i * 10);
+    }
+    // The largest key of the index order sits in the last slot of the root
+    key.keyval.intkey = -1;
+    REQUIRE(db.insertRecord(state, nullptr, &key, (char*) "payload") == SUCCESS);
+    keys.push_back(-1);
+
+    Record r;
+    TxnState* txn = nullptr;
+
+    SECTION( "full scans in both directions" ) {
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        std::vector<int64_t> ascending;
+        while (db.getNext(state, txn, &r) == SUCCESS) {
+            ascending.push_back(r.key.keyval.intkey);
+        }
+        REQUIRE(ascending == keys);
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        std::vector<int64_t> descending;
+        while (db.getPrev(state, txn, &r) == SUCCESS) {
+            descending.push_back(r.key.keyval.intkey);
+        }
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+        REQUIRE(std::equal(descending.begin(), descending.end(), keys.rbegin(), keys.rend()));
+
+        REQUIRE(db.getPrev(state, nullptr, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == -1);
+    }
+
+    SECTION( "get positions the cursor for both directions" ) {
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        r.key = key;
+        r.key.keyval.intkey = 12345;
+        REQUIRE(db.get(state, txn, &r) == KEY_NOTFOUND);
+        REQUIRE(db.getNext(state, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == 12350);
+        REQUIRE(db.getPrev(state, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == 12340);
+        REQUIRE(db.getPrev(state, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == 12330);
+
+        r.key.keyval.intkey = 500;
+        REQUIRE(db.get(state, txn, &r) == SUCCESS);
+        REQUIRE(db.getPrev(state, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == 490);
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+    }
+
+    SECTION( "latest records of a range" ) {
+        KeyRange range;
+        range.low.type = INT;
+        range.low.keyval.intkey = 1000;
+        range.lowType = INCLUSIVE;
+        range.high.type = INT;
+        range.high.keyval.intkey = 2005;
+        range.highType = EXCLUSIVE;
+
+        std::vector<Record> records(5);
+        size_t produced = 0;
+        REQUIRE(db.scanRangeDescending(state, nullptr, &range, records.data(), records.size(), &produced) == SUCCESS);
+        REQUIRE(produced == 5);
+        for (size_t i = 0; i < produced; i++) {
+            REQUIRE(records[i].key.keyval.intkey == 2000 - 10 * (int64_t) i);
+        }
+
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        REQUIRE(db.seekRangeDescending(state, txn, &range) == SUCCESS);
+        size_t count = 0;
+        int64_t last = 2010;
+        while (db.getPrev(state, txn, &r) == SUCCESS) {
+            REQUIRE(r.key.keyval.intkey == last - 10);
+            last = r.key.keyval.intkey;
+            count++;
+        }
+        REQUIRE(last == 1000);
+        REQUIRE(count == 101);
+        REQUIRE(db.getPrev(state, txn, &r) == DB_END);
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+    }
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Subtree counts answer range counts, ranks and selects", "[counts]" ) {
+    MemDB db;
+    IndexOptions options {};
+    options.subtreeCounts = 1;
+    REQUIRE(db.createWithOptions(INT, (char*) "counts", options) == SUCCESS);
+    REQUIRE(db.create(INT, (char*) "plain") == SUCCESS);
+    IdxState* state = nullptr;
+    IdxState* plain = nullptr;
+    REQUIRE(db.openIndex("counts", &state) == SUCCESS);
+    REQUIRE(db.openIndex("plain", &plain) == SUCCESS);
+
+    std::set<int64_t> keys;
+    Key key;
+    key.type = INT;
+    uint64_t value = 88172645463325252ull;
+    for (int i = 0; i < 6000; i++) {
+        value ^= value << 13;
+        value ^= value >> 7;
+        value ^= value << 17;
+        key.keyval.intkey = (int64_t) (value % 100000);
+        ErrCode result = db.insertRecord(state, nullptr, &key, (char*) "payload");
+        REQUIRE(result == (keys.insert(key.keyval.intkey).second ? SUCCESS : ENTRY_EXISTS));
+    }
+
+    // Second payloads do not add keys, deleting one of them does not remove any
+    key.keyval.intkey = *keys.begin();
+    REQUIRE(db.insertRecord(state, nullptr, &key, (char*) "second") == SUCCESS);
+    Record r;
+    r.key = key;
+    strcpy(r.payload, "second");
+    REQUIRE(db.deleteRecord(state, nullptr, &r) == SUCCESS);
+
+    // Deleted keys and aborted inserts leave the counts
+    int deleted = 0;
+    for (auto it = keys.begin(); it != keys.end() && deleted < 2000; deleted++) {
+        r.key.keyval.intkey = *it;
+        r.payload[0] = '\0';
+        REQUIRE(db.deleteRecord(state, nullptr, &r) == SUCCESS);
+        it = keys.erase(it);
+        std::advance(it, std::min<size_t>(1, std::distance(it, keys.end())));
+    }
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    for (int64_t i = 200000; i < 200100; i++) {
+        key.keyval.intkey = i;
+        REQUIRE(db.insertRecord(state, txn, &key, (char*) "aborted") == SUCCESS);
+    }
+    REQUIRE(db.abortTransaction(txn) == SUCCESS);
+
+    auto check = [&]() {
+        std::vector<int64_t> sorted(keys.begin(), keys.end());
+
+        KeyRange range;
+        range.low.type = INT;
+        range.high.type = INT;
+        range.lowType = UNBOUNDED;
+        range.highType = UNBOUNDED;
+        size_t count = 0;
+        REQUIRE(db.countRange(state, &range, &count) == SUCCESS);
+        REQUIRE(count == sorted.size());
+
+        for (int64_t probe = 0; probe < 100000; probe += 997) {
+            size_t rank = 0;
+            key.keyval.intkey = probe;
+            REQUIRE(db.rankOfKey(state, &key, &rank) == SUCCESS);
+            REQUIRE(rank == (size_t) (std::lower_bound(sorted.begin(), sorted.end(), probe) - sorted.begin()));
+
+            range.low.keyval.intkey = probe;
+            range.lowType = EXCLUSIVE;
+            range.high.keyval.intkey = probe + 5000;
+            range.highType = INCLUSIVE;
+            REQUIRE(db.countRange(state, &range, &count) == SUCCESS);
+            auto first = std::upper_bound(sorted.begin(), sorted.end(), probe);
+            auto last = std::upper_bound(sorted.begin(), sorted.end(), probe + 5000);
+            REQUIRE(count == (size_t) (last - first));
+        }
+
+        for (size_t rank = 0; rank < sorted.size(); rank += 37) {
+            Key selected;
+            REQUIRE(db.selectKey(state, rank, &selected) == SUCCESS);
+            REQUIRE(selected.keyval.intkey == sorted[rank]);
+        }
+        Key selected;
+        REQUIRE(db.selectKey(state, sorted.size(), &selected) == KEY_NOTFOUND);
+    };
+
+    check();
+
+    SECTION( "after compaction" ) {
+        REQUIRE(db.compactIndex(state) == SUCCESS);
+        check();
+    }
+
+    SECTION( "after bulk load" ) {
+        REQUIRE(db.createWithOptions(INT, (char*) "bulk", options) == SUCCESS);
+        IdxState* bulk = nullptr;
+        REQUIRE(db.openIndex("bulk", &bulk) == SUCCESS);
+
+        std::vector<Record> records;
+        for (auto k : keys) {
+            Record record;
+            record.key.type = INT;
+            record.key.keyval.intkey = k;
+            strcpy(record.payload, "payload");
+            records.push_back(record);
+        }
+        REQUIRE(db.bulkLoad(bulk, records.data(), records.size(), 2) == SUCCESS);
+        std::swap(state, bulk);
+        check();
+        std::swap(state, bulk);
+        REQUIRE(db.closeIndex(bulk) == SUCCESS);
+    }
+
+    size_t count = 0;
+    KeyRange range {};
+    REQUIRE(db.countRange(plain, &range, &count) == FAILURE);
+
+    REQUIRE(db.closeIndex(plain) == SUCCESS);
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Left-aligned varchar keys and prefix scans", "[prefix]" ) {
+    MemDB db;
+    IndexOptions options {};
+    options.leftAlignedVarchar = 1;
+    REQUIRE(db.createWithOptions(VARCHAR, (char*) "left", options) == SUCCESS);
+    REQUIRE(db.create(VARCHAR, (char*) "right") == SUCCESS);
+    IdxState* state = nullptr;
+    IdxState* right = nullptr;
+    REQUIRE(db.openIndex("left", &state) == SUCCESS);
+    REQUIRE(db.openIndex("right", &right) == SUCCESS);
+
+    std::set<std::string> keys = {"use", "user", "user:", "user:1", "user:1:a", "user:1:b", "user:10", "user:12:z",
+                                  "user:2", "user:2:x", "usez", "v", "user:1\xff", "user:1\xff\xff" "a", "user:2\xff"};
+    for (int i = 0; i < 300; i++) {
+        keys.insert("user:" + std::to_string(i * 7) + ":item");
+    }
+
+    Key key;
+    key.type = VARCHAR;
+    for (const auto& k : keys) {
+        strcpy(key.keyval.charkey, k.c_str());
+        REQUIRE(db.insertRecord(state, nullptr, &key, (char*) k.c_str()) == SUCCESS);
+    }
+
+    // Ordered lexicographically, unlike the right-aligned default
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    std::vector<std::string> scanned;
+    Record r;
+    while (db.getNext(state, txn, &r) == SUCCESS) {
+        scanned.emplace_back(r.key.keyval.charkey);
+        REQUIRE(scanned.back() == r.payload);
+    }
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+    REQUIRE(scanned == std::vector<std::string>(keys.begin(), keys.end()));
+
+    for (std::string prefix : {"user:1", "user:1\xff", "user:", "usez", "x", "", "user:21"}) {
+        std::vector<std::string> expected;
+        for (const auto& k : keys) {
+            if (k.compare(0, prefix.size(), prefix) == 0) {
+                expected.push_back(k);
+            }
+        }
+
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        std::vector<Record> records(8);
+        size_t produced = 0;
+        scanned.clear();
+        ErrCode result = db.prefixScan(state, txn, prefix.c_str(), records.data(), records.size(), &produced);
+        while (result == SUCCESS) {
+            for (size_t i = 0; i < produced; i++) {
+                scanned.emplace_back(records[i].key.keyval.charkey);
+            }
+            result = db.getNextBatch(state, txn, records.data(), records.size(), &produced);
+        }
+        REQUIRE(result == DB_END);
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+        REQUIRE(scanned == expected);
+    }
+
+    std::vector<Record> records(8);
+    size_t produced = 0;
+    REQUIRE(db.prefixScan(right, nullptr, "user", records.data(), records.size(), &produced) == FAILURE);
+
+    REQUIRE(db.closeIndex(right) == SUCCESS);
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "In-place updates and upserts", "[update]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "idx") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("idx", &state) == SUCCESS);
+
+    Key key;
+    key.type = INT;
+    key.keyval.intkey = 42;
+    REQUIRE(db.insertRecord(state, nullptr, &key, "a") == SUCCESS);
+    REQUIRE(db.insertRecord(state, nullptr, &key, "b") == SUCCESS);
+
+    REQUIRE(db.updateRecord(state, nullptr, &key, "a", "c") == SUCCESS);
+    REQUIRE(db.updateRecord(state, nullptr, &key, "a", "d") == ENTRY_DNE);
+    REQUIRE(db.updateRecord(state, nullptr, &key, "c", "b") == ENTRY_EXISTS);
+    key.keyval.intkey = 43;
+    REQUIRE(db.updateRecord(state, nullptr, &key, "a", "d") == KEY_NOTFOUND);
+    REQUIRE(db.upsertRecord(state, nullptr, &key, "a", "d") == SUCCESS);
+    REQUIRE(db.upsertRecord(state, nullptr, &key, "d", "e") == SUCCESS);
+
+    auto payloads = [&](TxnState* txn, int64_t k) {
+        std::set<std::string> result;
+        Record r;
+        r.key.type = INT;
+        r.key.keyval.intkey = k;
+        ErrCode err = db.get(state, txn, &r);
+        while (err == SUCCESS && r.key.keyval.intkey == k) {
+            result.insert(r.payload);
+            err = db.getNext(state, txn, &r);
+        }
+        return result;
+    };
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    REQUIRE(payloads(txn, 42) == std::set<std::string> {"b", "c"});
+    REQUIRE(payloads(txn, 43) == std::set<std::string> {"e"});
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+    SECTION("abort restores the old payloads") {
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        key.keyval.intkey = 42;
+        REQUIRE(db.updateRecord(state, txn, &key, "b", "f") == SUCCESS);
+        REQUIRE(db.updateRecord(state, txn, &key, "f", "g") == SUCCESS);
+        REQUIRE(db.insertRecord(state, txn, &key, "h") == SUCCESS);
+        REQUIRE(db.updateRecord(state, txn, &key, "h", "i") == SUCCESS);
+        key.keyval.intkey = 44;
+        REQUIRE(db.upsertRecord(state, txn, &key, "x", "y") == SUCCESS);
+        REQUIRE(db.upsertRecord(state, txn, &key, "y", "z") == SUCCESS);
+
+        REQUIRE(payloads(txn, 42) == std::set<std::string> {"c", "g", "i"});
+        REQUIRE(payloads(txn, 44) == std::set<std::string> {"z"});
+
+        // The uncommitted payloads are invisible to other transactions
+        TxnState* other = nullptr;
+        REQUIRE(db.beginTransaction(&other) == SUCCESS);
+        REQUIRE(payloads(other, 42) == std::set<std::string> {"c"});
+        REQUIRE(db.commitTransaction(other) == SUCCESS);
+
+        REQUIRE(db.abortTransaction(txn) == SUCCESS);
+
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        REQUIRE(payloads(txn, 42) == std::set<std::string> {"b", "c"});
+        REQUIRE(payloads(txn, 44).empty());
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+    }
+
+    SECTION("commit keeps the new payloads") {
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        key.keyval.intkey = 42;
+        REQUIRE(db.updateRecord(state, txn, &key, "b", "f") == SUCCESS);
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        REQUIRE(payloads(txn, 42) == std::set<std::string> {"c", "f"});
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+    }
+
+    SECTION("a cursor on the updated entry stays valid") {
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        Record r;
+        r.key.type = INT;
+        r.key.keyval.intkey = 42;
+        REQUIRE(db.get(state, txn, &r) == SUCCESS);
+        std::string first = r.payload;
+        std::string second = first == "b" ? "c" : "b";
+        key.keyval.intkey = 42;
+        REQUIRE(db.updateRecord(state, txn, &key, second.c_str(), "j") == SUCCESS);
+        REQUIRE(db.getNext(state, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == 42);
+        REQUIRE(std::string(r.payload) == "j");
+        REQUIRE(db.getNext(state, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == 43);
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+    }
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Range deletes and truncate", "[deleteRange]" ) {
+    MemDB db;
+    IndexOptions options {};
+    options.subtreeCounts = GENERATE(0, 1);
+    REQUIRE(db.createWithOptions(INT, (char*) "idx", options) == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("idx", &state) == SUCCESS);
+
+    std::set<int64_t> keys;
+    uint64_t seed = 7;
+    Key key;
+    key.type = INT;
+    for (int i = 0; i < 5000; i++) {
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        int64_t k = (seed >> 40) % 100000;
+        if (i % 5 == 0) {
+            k = 100000 + i;
+        }
+        keys.insert(k);
+        key.keyval.intkey = k;
+        db.insertRecord(state, nullptr, &key, "a");
+        db.insertRecord(state, nullptr, &key, std::to_string(k % 3).c_str());
+    }
+
+    auto scanAll = [&]() {
+        std::vector<int64_t> result;
+        TxnState* txn = nullptr;
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        Record r;
+        while (db.getNext(state, txn, &r) == SUCCESS) {
+            if (result.empty() || result.back() != r.key.keyval.intkey) {
+                result.push_back(r.key.keyval.intkey);
+            }
+        }
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+        return result;
+    };
+
+    KeyRange range {};
+    range.low.type = INT;
+    range.high.type = INT;
+
+    SECTION("deleteRange removes exactly the keys in the range") {
+        std::vector<std::pair<int64_t, int64_t>> ranges = {{1000, 1999}, {50000, 50000}, {0, 17}, {70000, 98999},
+                                                           {100000, 100002}, {20000, 20000}, {99999, 100100}};
+        for (size_t i = 0; i < ranges.size(); i++) {
+            range.low.keyval.intkey = ranges[i].first;
+            range.high.keyval.intkey = ranges[i].second;
+            range.lowType = i % 2 ? EXCLUSIVE : INCLUSIVE;
+            range.highType = i % 3 ? INCLUSIVE : EXCLUSIVE;
+
+            size_t expected = 0;
+            for (auto it = keys.begin(); it != keys.end();) {
+                bool aboveLow = *it > ranges[i].first || (*it == ranges[i].first && range.lowType == INCLUSIVE);
+                bool belowHigh = *it < ranges[i].second || (*it == ranges[i].second && range.highType == INCLUSIVE);
+                if (aboveLow && belowHigh) {
+                    expected += 2;
+                    it = keys.erase(it);
+                }
+                else {
+                    it++;
+                }
+            }
+
+            size_t deleted = 0;
+            REQUIRE(db.deleteRange(state, &range, &deleted) == SUCCESS);
+            REQUIRE(deleted == expected);
+            REQUIRE(scanAll() == std::vector<int64_t>(keys.begin(), keys.end()));
+
+            if (options.subtreeCounts) {
+                KeyRange all {};
+                size_t count = 0;
+                REQUIRE(db.countRange(state, &all, &count) == SUCCESS);
+                REQUIRE(count == keys.size());
+            }
+        }
+
+        range.lowType = UNBOUNDED;
+        range.highType = INCLUSIVE;
+        range.high.keyval.intkey = 100500;
+        REQUIRE(db.deleteRange(state, &range, nullptr) == SUCCESS);
+        REQUIRE(scanAll() == std::vector<int64_t>(keys.upper_bound(100500), keys.end()));
+
+        for (int64_t k : {5, 100501, 100000}) {
+            key.keyval.intkey = k;
+            REQUIRE(db.insertRecord(state, nullptr, &key, "b") == SUCCESS);
+            keys.insert(k);
+        }
+        keys.erase(keys.begin(), keys.upper_bound(100500));
+        keys.insert({5, 100000, 100501});
+        REQUIRE(scanAll() == std::vector<int64_t>(keys.begin(), keys.end()));
+    }
+
+    SECTION("a cursor continues behind a deleted range") {
+        TxnState* txn = nullptr;
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        Record r;
+        r.key.type = INT;
+        r.key.keyval.intkey = *keys.lower_bound(30000);
+        REQUIRE(db.get(state, txn, &r) == SUCCESS);
+        REQUIRE(db.getNext(state, txn, &r) == SUCCESS);
+
+        range.lowType = INCLUSIVE;
+        range.highType = INCLUSIVE;
+        range.low.keyval.intkey = 30000;
+        range.high.keyval.intkey = 60000;
+        REQUIRE(db.deleteRange(state, &range, nullptr) == SUCCESS);
+
+        REQUIRE(db.getNext(state, txn, &r) == SUCCESS);
+        REQUIRE(r.key.keyval.intkey == *keys.upper_bound(60000));
+
+        // The delete was not part of the transaction
+        REQUIRE(db.abortTransaction(txn) == SUCCESS);
+        keys.erase(keys.lower_bound(30000), keys.upper_bound(60000));
+        REQUIRE(scanAll() == std::vector<int64_t>(keys.begin(), keys.end()));
+    }
+
+    SECTION("truncateIndex empties the index") {
+        TxnState* txn = nullptr;
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        Record r;
+        REQUIRE(db.getNext(state, txn, &r) == SUCCESS);
+        key.keyval.intkey = 123456789;
+        REQUIRE(db.insertRecord(state, txn, &key, "c") == SUCCESS);
+
+        REQUIRE(db.truncateIndex(state) == SUCCESS);
+        REQUIRE(db.getNext(state, txn, &r) == DB_END);
+        REQUIRE(db.abortTransaction(txn) == SUCCESS);
+        REQUIRE(scanAll().empty());
+
+        key.keyval.intkey = 17;
+        REQUIRE(db.insertRecord(state, nullptr, &key, "d") == SUCCESS);
+        REQUIRE(scanAll() == std::vector<int64_t> {17});
+        if (options.subtreeCounts) {
+            size_t rank = 0;
+            REQUIRE(db.rankOfKey(state, &key, &rank) == SUCCESS);
+            REQUIRE(rank == 0);
+        }
+    }
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Zero-copy reads under a read guard", "[views]" ) {
+    MemDB db;
+    IndexOptions options {};
+    options.leftAlignedVarchar = GENERATE(0, 1);
+    REQUIRE(db.createWithOptions(VARCHAR, (char*) "idx", options) == SUCCESS);
+    IdxState* state = nullptr;
+    IdxState* writer = nullptr;
+    REQUIRE(db.openIndex("idx", &state) == SUCCESS);
+    REQUIRE(db.openIndex("idx", &writer) == SUCCESS);
+
+    Key key;
+    key.type = VARCHAR;
+    strcpy(key.keyval.charkey, "apple");
+    REQUIRE(db.insertRecord(writer, nullptr, &key, "red") == SUCCESS);
+    strcpy(key.keyval.charkey, "banana");
+    REQUIRE(db.insertRecord(writer, nullptr, &key, "yellow") == SUCCESS);
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    {
+        ReadGuard guard(db, state);
+        RecordView apple {};
+        RecordView banana {};
+        strcpy(key.keyval.charkey, "apple");
+        REQUIRE(guard.get(txn, &key, &apple) == SUCCESS);
+        REQUIRE(apple.key.charkey == "apple");
+        REQUIRE(apple.payload == "red");
+        REQUIRE(guard.getNext(txn, &banana) == SUCCESS);
+        REQUIRE(banana.key.type == VARCHAR);
+        REQUIRE(banana.key.charkey == "banana");
+        REQUIRE(banana.payload == "yellow");
+
+        strcpy(key.keyval.charkey, "cherry");
+        RecordView missing {};
+        REQUIRE(guard.get(txn, &key, &missing) == KEY_NOTFOUND);
+
+        // Writers do not change what the views point at while the guard lives
+        strcpy(key.keyval.charkey, "apple");
+        REQUIRE(db.updateRecord(writer, nullptr, &key, "red", "green") == SUCCESS);
+        Record r;
+        r.key = key;
+        strcpy(r.payload, "");
+        REQUIRE(db.deleteRecord(writer, nullptr, &r) == SUCCESS);
+        strcpy(key.keyval.charkey, "banana");
+        REQUIRE(db.updateRecord(writer, nullptr, &key, "yellow", "brown") == SUCCESS);
+        for (int i = 0; i < 140000; i++) {
+            strcpy(key.keyval.charkey, ("key" + std::to_string(i)).c_str());
+            REQUIRE(db.insertRecord(writer, nullptr, &key, "x") == SUCCESS);
+        }
+
+        REQUIRE(apple.key.charkey == "apple");
+        REQUIRE(apple.payload == "red");
+        REQUIRE(banana.key.charkey == "banana");
+        REQUIRE(banana.payload == "yellow");
+
+        // The update is newer than the transaction, a new one sees it
+        TxnState* later = nullptr;
+        REQUIRE(db.beginTransaction(&later) == SUCCESS);
+        strcpy(key.keyval.charkey, "banana");
+        RecordView current {};
+        REQUIRE(guard.get(later, &key, &current) == SUCCESS);
+        REQUIRE(current.payload == "brown");
+        REQUIRE(guard.getNext(later, &current) == SUCCESS);
+        REQUIRE(current.key.charkey.substr(0, 3) == "key");
+        REQUIRE(db.commitTransaction(later) == SUCCESS);
+    }
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+    REQUIRE(db.closeIndex(writer) == SUCCESS);
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Read guard across a bulk load into an emptied index", "[views]" ) {
+    MemDB db;
+    REQUIRE(db.create(VARCHAR, (char*) "idx") == SUCCESS);
+    IdxState* state = nullptr;
+    IdxState* writer = nullptr;
+    REQUIRE(db.openIndex("idx", &state) == SUCCESS);
+    REQUIRE(db.openIndex("idx", &writer) == SUCCESS);
+
+    Record r;
+    r.key.type = VARCHAR;
+    strcpy(r.key.keyval.charkey, "apple");
+    REQUIRE(db.insertRecord(writer, nullptr, &r.key, "red") == SUCCESS);
+
+    {
+        ReadGuard guard(db, state);
+        RecordView apple {};
+        REQUIRE(guard.get(nullptr, &r.key, &apple) == SUCCESS);
+
+        // The bulk load takes the path for empty trees, but the deleted key is still retired, and the load grows the
+        // L1 items past their initial capacity
+        strcpy(r.payload, "");
+        REQUIRE(db.deleteRecord(writer, nullptr, &r) == SUCCESS);
+        std::vector<Record> records(140000);
+        for (size_t i = 0; i < records.size(); i++) {
+            records[i].key.type = VARCHAR;
+            strcpy(records[i].key.keyval.charkey, ("key" + std::to_string(i)).c_str());
+            strcpy(records[i].payload, "x");
+        }
+        REQUIRE(db.bulkLoad(writer, records.data(), records.size(), 2) == SUCCESS);
+
+        REQUIRE(apple.key.charkey == "apple");
+        REQUIRE(apple.payload == "red");
+    }
+
+    strcpy(r.key.keyval.charkey, "key139999");
+    REQUIRE(db.get(state, nullptr, &r) == SUCCESS);
+    REQUIRE(std::string(r.payload) == "x");
+
+    REQUIRE(db.closeIndex(writer) == SUCCESS);
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Zero-copy reads of integer keys", "[views]" ) {
+    MemDB db;
+    REQUIRE(db.create(SHORT, (char*) "idx") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("idx", &state) == SUCCESS);
+
+    Key key;
+    key.type = SHORT;
+    for (int32_t k : {-5, 3, 70000}) {
+        key.keyval.shortkey = k;
+        REQUIRE(db.insertRecord(state, nullptr, &key, std::to_string(k).c_str()) == SUCCESS);
+    }
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    std::vector<int64_t> keys;
+    {
+        ReadGuard guard(db, state);
+        RecordView view {};
+        while (guard.getNext(txn, &view) == SUCCESS) {
+            REQUIRE(view.key.type == SHORT);
+            REQUIRE(view.payload == std::to_string(view.key.intkey));
+            keys.push_back(view.key.intkey);
+        }
+    }
+    REQUIRE(keys == std::vector<int64_t> {3, 70000, -5});
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Typed C++ API", "[typed]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "ints") == SUCCESS);
+    IndexOptions options {};
+    options.leftAlignedVarchar = 1;
+    REQUIRE(db.createWithOptions(VARCHAR, (char*) "strings", options) == SUCCESS);
+
+    Index<int64_t> ints;
+    Index<std::string_view> strings;
+    Index<int32_t> wrongType;
+    REQUIRE(ints.open(db, "ints") == SUCCESS);
+    REQUIRE(strings.open(db, "strings") == SUCCESS);
+    REQUIRE(wrongType.open(db, "ints") == FAILURE);
+    REQUIRE(wrongType.open(db, "missing") == DB_DNE);
+
+    char payload[MAX_PAYLOAD_LEN + 1];
+    REQUIRE(ints.insert(nullptr, 42, "a") == SUCCESS);
+    REQUIRE(ints.insert(nullptr, 42, "a") == ENTRY_EXISTS);
+    REQUIRE(ints.get(nullptr, 42, payload) == SUCCESS);
+    REQUIRE(std::string(payload) == "a");
+
+    // The typed and the C-style calls see the same index
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("ints", &state) == SUCCESS);
+    Record record;
+    record.key.type = INT;
+    record.key.keyval.intkey = 42;
+    REQUIRE(db.get(state, nullptr, &record) == SUCCESS);
+    REQUIRE(std::string(record.payload) == "a");
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+
+    {
+        Transaction txn(db);
+        REQUIRE(ints.insert(&txn, 7, "b") == SUCCESS);
+        REQUIRE(ints.update(&txn, 42, "a", "c") == SUCCESS);
+        REQUIRE(ints.get(&txn, 7, payload) == SUCCESS);
+        // Goes out of scope without a commit
+    }
+    REQUIRE(ints.get(nullptr, 7, payload) == KEY_NOTFOUND);
+    REQUIRE(ints.get(nullptr, 42, payload) == SUCCESS);
+    REQUIRE(std::string(payload) == "a");
+
+    {
+        Transaction txn(db);
+        REQUIRE(ints.insert(&txn, 7, "b") == SUCCESS);
+        REQUIRE(strings.insert(&txn, "pear", "1") == SUCCESS);
+        REQUIRE(strings.insert(&txn, "apple", "2") == SUCCESS);
+        REQUIRE(strings.insert(&txn, "apples", "3") == SUCCESS);
+        txn.commit();
+    }
+
+    Transaction txn(db);
+    std::vector<std::pair<int64_t, std::string>> intEntries;
+    Index<int64_t>::Entry intEntry;
+    while (ints.getNext(&txn, &intEntry) == SUCCESS) {
+        intEntries.emplace_back(intEntry.key, intEntry.payload);
+    }
+    REQUIRE(intEntries == std::vector<std::pair<int64_t, std::string>> {{7, "b"}, {42, "a"}});
+
+    std::vector<std::string> keys;
+    Index<std::string_view>::Entry stringEntry;
+    REQUIRE(strings.get(&txn, "apple", payload) == SUCCESS);
+    keys.emplace_back("apple");
+    while (strings.getNext(&txn, &stringEntry) == SUCCESS) {
+        keys.push_back(stringEntry.key);
+    }
+    REQUIRE(keys == std::vector<std::string> {"apple", "apples", "pear"});
+
+    REQUIRE(strings.remove(&txn, "apples") == SUCCESS);
+    REQUIRE(strings.remove(&txn, "pear", "2") == ENTRY_DNE);
+    REQUIRE(strings.get(&txn, "apples", payload) == KEY_NOTFOUND);
+    txn.commit();
+
+    // Keys the C API can not represent are rejected instead of aliasing other keys
+    std::string tooLong(MAX_VARCHAR_LEN + 1, 'x');
+    REQUIRE(strings.insert(nullptr, tooLong, "1") == FAILURE);
+    REQUIRE(strings.get(nullptr, std::string_view(tooLong).substr(0, MAX_VARCHAR_LEN), payload) == KEY_NOTFOUND);
+    REQUIRE(strings.insert(nullptr, std::string_view("pe\0ar", 5), "1") == FAILURE);
+    REQUIRE(strings.get(nullptr, std::string_view("pe\0ar", 5), payload) == FAILURE);
+
+    // Move assignment closes the old handle and takes over the other one
+    Index<std::string_view> moved;
+    moved = std::move(strings);
+    REQUIRE(strings.idxState() == nullptr);
+    REQUIRE(moved.get(nullptr, "pear", payload) == SUCCESS);
+    moved = Index<std::string_view> {};
+    REQUIRE(moved.idxState() == nullptr);
+}
+
+template<typename Tree, typename Key, typename F>
+static void checkAgainstMap(F randomKey) {
+    Tree tree;
+    std::map<Key, std::string> reference;
+    std::mt19937 rng(42);
+
+    for (int i = 0; i < 20000; i++) {
+        Key key = randomKey(rng);
+        switch (rng() % 4) {
+            case 0:
+            case 1: {
+                // Values are not limited to MAX_PAYLOAD_LEN
+                std::string value(rng() % 300, 'a' + i % 26);
+                auto inserted = tree.try_emplace(key, value).second;
+                REQUIRE(inserted == reference.try_emplace(key, value).second);
+                break;
+            }
+            case 2:
+                REQUIRE(tree.erase(key) == reference.erase(key));
+                break;
+            case 3: {
+                auto it = tree.lower_bound(key);
+                auto expected = reference.lower_bound(key);
+                if (expected == reference.end()) {
+                    REQUIRE(it == tree.end());
+                }
+                else {
+                    REQUIRE(it != tree.end());
+                    REQUIRE(it->first == expected->first);
+                    REQUIRE(it->second == expected->second);
+                    if (it != tree.begin()) {
+                        REQUIRE(std::prev(it)->first == std::prev(expected)->first);
+                    }
+                    REQUIRE((tree.upper_bound(key) == tree.end()) == (reference.upper_bound(key) == reference.end()));
+                }
+                break;
+            }
+        }
+    }
+
+    REQUIRE(tree.size() == reference.size());
+    REQUIRE(std::equal(tree.begin(), tree.end(), reference.begin(), reference.end()));
+
+    std::vector<Key> backwards;
+    for (auto it = tree.end(); it != tree.begin();) {
+        backwards.push_back((--it)->first);
+    }
+    std::reverse(backwards.begin(), backwards.end());
+    std::vector<Key> keys;
+    for (const auto& entry : reference) {
+        keys.push_back(entry.first);
+    }
+    REQUIRE(backwards == keys);
+
+    // Erasing while iterating
+    for (auto it = tree.begin(); it != tree.end();) {
+        it = it->first < keys[keys.size() / 2] ? tree.erase(it) : std::next(it);
+    }
+    REQUIRE(tree.size() == keys.size() - keys.size() / 2);
+    REQUIRE(tree.begin()->first == keys[keys.size() / 2]);
+}
+
+TEST_CASE( "Generic prefix tree container", "[prefix_tree]" ) {
+    checkAgainstMap<prefix_tree<int64_t, std::string>, int64_t>([](std::mt19937& rng) {
+        return (int64_t) rng() % 5000 - 2500 + ((int64_t) (rng() % 3) << 40);
+    });
+    checkAgainstMap<prefix_tree<int32_t, std::string, 2>, int32_t>([](std::mt19937& rng) {
+        return (int32_t) (rng() % 4000) - 2000;
+    });
+    checkAgainstMap<prefix_tree<uint16_t, std::string, 8>, uint16_t>([](std::mt19937& rng) {
+        return (uint16_t) (rng() % 3000 * 17);
+    });
+    checkAgainstMap<prefix_tree<std::array<uint8_t, 3>, std::string, 1>, std::array<uint8_t, 3>>([](std::mt19937& rng) {
+        return std::array<uint8_t, 3> {(uint8_t) (rng() % 4), (uint8_t) (rng() % 256), 7};
+    });
+
+    prefix_tree<int, std::vector<int>> tree;
+    tree[3].push_back(1);
+    tree[3].push_back(2);
+    tree.insert_or_assign(-1, std::vector<int> {5});
+    REQUIRE(tree.size() == 2);
+    REQUIRE(tree.begin()->first == -1);
+    REQUIRE(tree.find(3)->second == std::vector<int> {1, 2});
+    REQUIRE(tree.find(4) == tree.end());
+    REQUIRE(tree.contains(-1));
+    const auto& constTree = tree;
+    prefix_tree<int, std::vector<int>>::const_iterator it = tree.begin();
+    REQUIRE(it == constTree.begin());
+    tree.clear();
+    REQUIRE(tree.empty());
+    REQUIRE(tree.begin() == tree.end());
+
+    // Keys that are multiples of 16 are unique above the last level, inserting the next key pushes the current leaf
+    // down. The scan still visits the new key.
+    prefix_tree<int, int> growing;
+    for (int k = 0; k < 16000; k += 16) {
+        growing[k] = k;
+    }
+    std::vector<int> visited;
+    for (auto it = growing.begin(); it != growing.end(); ++it) {
+        visited.push_back(it->first);
+        if (it->first < 8000 && it->first % 16 == 0) {
+            growing[it->first + 1] = 0;
+        }
+    }
+    std::vector<int> expected;
+    for (int k = 0; k < 16000; k += 16) {
+        expected.push_back(k);
+        if (k < 8000) {
+            expected.push_back(k + 1);
+        }
+    }
+    REQUIRE(visited == expected);
+}
+
+TEST_CASE( "Row id payloads", "[rowId]" ) {
+    MemDB db;
+    IndexOptions options {};
+    options.rowIdPayloads = 1;
+    REQUIRE(db.createWithOptions(INT, (char*) "rows", options) == SUCCESS);
+    REQUIRE(db.create(INT, (char*) "strings") == SUCCESS);
+    IdxState* state = nullptr;
+    IdxState* strings = nullptr;
+    REQUIRE(db.openIndex("rows", &state) == SUCCESS);
+    REQUIRE(db.openIndex("strings", &strings) == SUCCESS);
+
+    Key key;
+    key.type = INT;
+    for (int64_t k = 0; k < 1000; k++) {
+        key.keyval.intkey = k * 7;
+        for (uint64_t r = 0; r < (uint64_t) k % 4 + 1; r++) {
+            REQUIRE(db.insertRowId(state, nullptr, &key, (uint64_t) k << 32 | r) == SUCCESS);
+        }
+    }
+    key.keyval.intkey = 14;
+    REQUIRE(db.insertRowId(state, nullptr, &key, 2ULL << 32) == ENTRY_EXISTS);
+
+    // String payloads and row ids do not mix
+    Record record;
+    record.key = key;
+    uint64_t rowId = 0;
+    REQUIRE(db.insertRecord(state, nullptr, &key, "a") == FAILURE);
+    REQUIRE(db.get(state, nullptr, &record) == FAILURE);
+    REQUIRE(db.insertRowId(strings, nullptr, &key, 1) == FAILURE);
+    REQUIRE(db.getRowId(strings, nullptr, &key, &rowId) == FAILURE);
+
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    REQUIRE(db.getRowId(state, txn, &key, &rowId) == SUCCESS);
+    REQUIRE(rowId == 2ULL << 32);
+    Key next;
+    REQUIRE(db.getNextRowId(state, txn, &next, &rowId) == SUCCESS);
+    REQUIRE(next.keyval.intkey == 14);
+    REQUIRE(rowId == (2ULL << 32 | 1));
+
+    // Deleting the returned row id keeps the cursor in place
+    REQUIRE(db.deleteRowId(state, nullptr, &key, 2ULL << 32 | 1) == SUCCESS);
+    REQUIRE(db.deleteRowId(state, nullptr, &key, 2ULL << 32 | 1) == ENTRY_DNE);
+    REQUIRE(db.getNextRowId(state, txn, &next, &rowId) == SUCCESS);
+    REQUIRE(next.keyval.intkey == 14);
+    REQUIRE(rowId == (2ULL << 32 | 2));
+    REQUIRE(db.getNextRowId(state, txn, &next, &rowId) == SUCCESS);
+    REQUIRE(next.keyval.intkey == 21);
+    REQUIRE(rowId == 3ULL << 32);
+
+    size_t count = 0;
+    while (db.getNextRowId(state, txn, &next, &rowId) == SUCCESS) {
+        REQUIRE((int64_t) (rowId >> 32) * 7 == next.keyval.intkey);
+        count++;
+    }
+    REQUIRE(count == 2500 - 3 - 3 - 1);
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+    // Aborted inserts are undone, deletes of whole keys take all row ids
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    key.keyval.intkey = 5;
+    REQUIRE(db.insertRowId(state, txn, &key, 42) == SUCCESS);
+    key.keyval.intkey = 7;
+    REQUIRE(db.insertRowId(state, txn, &key, 42) == SUCCESS);
+    REQUIRE(db.getRowId(state, txn, &key, &rowId) == SUCCESS);
+    REQUIRE(db.abortTransaction(txn) == SUCCESS);
+    REQUIRE(db.getRowId(state, nullptr, &key, &rowId) == SUCCESS);
+    REQUIRE(db.getNextRowId(state, nullptr, &next, &rowId) == SUCCESS);
+    key.keyval.intkey = 5;
+    REQUIRE(db.getRowId(state, nullptr, &key, &rowId) == KEY_NOTFOUND);
+    key.keyval.intkey = 21;
+    record.key = key;
+    record.payload[0] = 0;
+    REQUIRE(db.deleteRecord(state, nullptr, &record) == SUCCESS);
+    REQUIRE(db.getRowId(state, nullptr, &key, &rowId) == KEY_NOTFOUND);
+
+    // Deletes of row ids are not undone by an abort
+    key.keyval.intkey = 7;
+    REQUIRE(db.getRowId(state, nullptr, &key, &rowId) == SUCCESS);
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    REQUIRE(db.deleteRowId(state, txn, &key, rowId) == SUCCESS);
+    REQUIRE(db.abortTransaction(txn) == SUCCESS);
+    REQUIRE(db.deleteRowId(state, nullptr, &key, rowId) == ENTRY_DNE);
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+    REQUIRE(db.closeIndex(strings) == SUCCESS);
+}
+
+TEST_CASE( "Interned payloads", "[intern]" ) {
+    MemDB db;
+    IndexOptions options {};
+    options.internPayloads = 1;
+    REQUIRE(db.createWithOptions(INT, (char*) "interned", options) == SUCCESS);
+    REQUIRE(db.create(INT, (char*) "plain") == SUCCESS);
+    IdxState* interned = nullptr;
+    IdxState* plain = nullptr;
+    REQUIRE(db.openIndex("interned", &interned) == SUCCESS);
+    REQUIRE(db.openIndex("plain", &plain) == SUCCESS);
+
+    // Both indices see the same operations and have to give the same answers
+    std::mt19937 rng(45);
+    Key key;
+    key.type = INT;
+    for (int i = 0; i < 20000; i++) {
+        key.keyval.intkey = rng() % 2000;
+        std::string payload = "tenant-" + std::to_string(rng() % 20);
+        std::string other = "tenant-" + std::to_string(rng() % 20);
+        Record record;
+        record.key = key;
+
+        switch (rng() % 6) {
+            case 0:
+            case 1:
+                REQUIRE(db.insertRecord(interned, nullptr, &key, payload.c_str()) == db.insertRecord(plain, nullptr, &key, payload.c_str()));
+                break;
+            case 2:
+                strcpy(record.payload, rng() % 10 ? payload.c_str() : "");
+                REQUIRE(db.deleteRecord(interned, nullptr, &record) == db.deleteRecord(plain, nullptr, &record));
+                break;
+            case 3:
+                REQUIRE(db.updateRecord(interned, nullptr, &key, payload.c_str(), other.c_str()) == db.updateRecord(plain, nullptr, &key, payload.c_str(), other.c_str()));
+                break;
+            case 4: {
+                Record a = record;
+                Record b = record;
+                auto result = db.get(interned, nullptr, &a);
+                REQUIRE(result == db.get(plain, nullptr, &b));
+                if (result == SUCCESS) {
+                    REQUIRE(std::string(a.payload) == b.payload);
+                }
+                break;
+            }
+            default: {
+                // Aborted transactions leave no trace
+                TxnState* txn = nullptr;
+                REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+                db.insertRecord(interned, txn, &key, other.c_str());
+                db.updateRecord(interned, txn, &key, payload.c_str(), other.c_str());
+                REQUIRE(db.abortTransaction(txn) == SUCCESS);
+            }
+        }
+    }
+
+    auto scanAll = [&](IdxState* state) {
+        std::vector<std::pair<int64_t, std::string>> result;
+        TxnState* txn = nullptr;
+        REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+        Record r;
+        while (db.getNext(state, txn, &r) == SUCCESS) {
+            result.emplace_back(r.key.keyval.intkey, r.payload);
+        }
+        REQUIRE(db.commitTransaction(txn) == SUCCESS);
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+    auto contents = scanAll(plain);
+    REQUIRE(contents.size() > 1000);
+    REQUIRE(scanAll(interned) == contents);
+
+    // A view of an updated payload stays readable while the guard is held
+    key.keyval.intkey = contents.front().first;
+    {
+        ReadGuard guard(db, interned);
+        RecordView view {};
+        REQUIRE(guard.get(nullptr, &key, &view) == SUCCESS);
+        std::string before(view.payload);
+        REQUIRE(db.updateRecord(interned, nullptr, &key, before.c_str(), "moved") == SUCCESS);
+        Record record;
+        record.key = key;
+        strcpy(record.payload, "moved");
+        REQUIRE(db.deleteRecord(interned, nullptr, &record) == SUCCESS);
+        REQUIRE(db.insertRecord(interned, nullptr, &key, "filler") == SUCCESS);
+        REQUIRE(view.payload == before);
+    }
+
+    REQUIRE(db.truncateIndex(interned) == SUCCESS);
+    REQUIRE(scanAll(interned).empty());
+    REQUIRE(db.insertRecord(interned, nullptr, &key, "tenant-1") == SUCCESS);
+    REQUIRE(scanAll(interned).size() == 1);
+
+    REQUIRE(db.closeIndex(interned) == SUCCESS);
+    REQUIRE(db.closeIndex(plain) == SUCCESS);
+}
+
+TEST_CASE( "Hot key cache", "[hotKeys]" ) {
+    MemDB db;
+    IndexOptions options {};
+    options.hotKeyCacheSize = 100;
+    REQUIRE(db.createWithOptions(INT, (char*) "cached", options) == SUCCESS);
+    REQUIRE(db.create(INT, (char*) "plain") == SUCCESS);
+    IdxState* cached = nullptr;
+    IdxState* plain = nullptr;
+    REQUIRE(db.openIndex("cached", &cached) == SUCCESS);
+    REQUIRE(db.openIndex("plain", &plain) == SUCCESS);
+
+    // Few hot keys, deletes release L1 items whose slots get reused by other keys
+    std::mt19937 rng(46);
+    Key key;
+    key.type = INT;
+    for (int i = 0; i < 50000; i++) {
+        key.keyval.intkey = rng() % 4 ? rng() % 50 : rng() % 5000;
+        std::string payload = std::to_string(rng() % 3);
+        Record a;
+        a.key = key;
+        Record b = a;
+
+        switch (rng() % 4) {
+            case 0:
+                REQUIRE(db.insertRecord(cached, nullptr, &key, payload.c_str()) == db.insertRecord(plain, nullptr, &key, payload.c_str()));
+                break;
+            case 1:
+                a.payload[0] = 0;
+                b.payload[0] = 0;
+                REQUIRE(db.deleteRecord(cached, nullptr, &a) == db.deleteRecord(plain, nullptr, &b));
+                break;
+            default: {
+                auto result = db.get(cached, nullptr, &a);
+                REQUIRE(result == db.get(plain, nullptr, &b));
+                if (result == SUCCESS) {
+                    REQUIRE(std::string(a.payload) == b.payload);
+                }
+            }
+        }
+    }
+
+    // Repeated lookups of the hot keys are served by the cache, apart from keys sharing a slot
+    IndexStatistics before {};
+    REQUIRE(db.getIndexStatistics(cached, &before) == SUCCESS);
+    size_t found = 0;
+    for (int round = 0; round < 3; round++) {
+        for (int k = 0; k < 50; k++) {
+            Record record;
+            record.key = key;
+            record.key.keyval.intkey = k;
+            found += db.get(cached, nullptr, &record) == SUCCESS;
+        }
+    }
+    IndexStatistics after {};
+    REQUIRE(db.getIndexStatistics(cached, &after) == SUCCESS);
+    REQUIRE(found > 0);
+    REQUIRE(after.hotKeyHits - before.hotKeyHits >= found / 3);
+    REQUIRE(plain->tree->statistics().hotKeyHits == 0);
+
+    KeyRange range {};
+    range.low.type = INT;
+    range.high.type = INT;
+    range.low.keyval.intkey = 10;
+    range.high.keyval.intkey = 30;
+    range.lowType = INCLUSIVE;
+    range.highType = INCLUSIVE;
+    REQUIRE(db.deleteRange(cached, &range, nullptr) == SUCCESS);
+    Record record;
+    record.key = key;
+    record.key.keyval.intkey = 20;
+    REQUIRE(db.get(cached, nullptr, &record) == KEY_NOTFOUND);
+
+    REQUIRE(db.truncateIndex(cached) == SUCCESS);
+    record.key.keyval.intkey = 40;
+    REQUIRE(db.get(cached, nullptr, &record) == KEY_NOTFOUND);
+
+    REQUIRE(db.closeIndex(cached) == SUCCESS);
+    REQUIRE(db.closeIndex(plain) == SUCCESS);
+}
+
+TEST_CASE( "Hash index next to the trie", "[hashIndex]" ) {
+    MemDB db;
+    IndexOptions options {};
+    options.hashIndex = 1;
+    options.hotKeyCacheSize = 64;
+    REQUIRE(db.createWithOptions(VARCHAR, (char*) "hashed", options) == FAILURE);
+    options.hotKeyCacheSize = 0;
+    REQUIRE(db.createWithOptions(VARCHAR, (char*) "hashed", options) == SUCCESS);
+    REQUIRE(db.create(VARCHAR, (char*) "plain") == SUCCESS);
+    IdxState* hashed = nullptr;
+    IdxState* plain = nullptr;
+    REQUIRE(db.openIndex("hashed", &hashed) == SUCCESS);
+    REQUIRE(db.openIndex("plain", &plain) == SUCCESS);
+
+    // Starts from a bulk load, the following operations take the incremental paths
+    std::vector<Record> records(3000);
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i].key.type = VARCHAR;
+        strcpy(records[i].key.keyval.charkey, ("user/" + std::to_string(i * 7 % 5000)).c_str());
+        strcpy(records[i].payload, "p");
+    }
+    REQUIRE(db.bulkLoad(hashed, records.data(), records.size(), 2) == SUCCESS);
+    REQUIRE(db.bulkLoad(plain, records.data(), records.size(), 2) == SUCCESS);
+
+    std::mt19937 rng(47);
+    Record a;
+    a.key.type = VARCHAR;
+    for (int i = 0; i < 30000; i++) {
+        strcpy(a.key.keyval.charkey, ("user/" + std::to_string(rng() % 5000)).c_str());
+        strcpy(a.payload, rng() % 2 ? "p" : "q");
+        Record b = a;
+
+        switch (rng() % 5) {
+            case 0:
+                REQUIRE(db.insertRecord(hashed, nullptr, &a.key, a.payload) == db.insertRecord(plain, nullptr, &b.key, b.payload));
+                break;
+            case 1:
+                REQUIRE(db.deleteRecord(hashed, nullptr, &a) == db.deleteRecord(plain, nullptr, &b));
+                break;
+            case 2: {
+                KeyRange range {};
+                range.low = a.key;
+                range.high = a.key;
+                range.high.keyval.charkey[strlen(range.high.keyval.charkey) - 1]++;
+                range.lowType = INCLUSIVE;
+                range.highType = EXCLUSIVE;
+                size_t deletedA = 0;
+                size_t deletedB = 0;
+                REQUIRE(db.deleteRange(hashed, &range, &deletedA) == SUCCESS);
+                REQUIRE(db.deleteRange(plain, &range, &deletedB) == SUCCESS);
+                REQUIRE(deletedA == deletedB);
+                break;
+            }
+            default: {
+                auto result = db.get(hashed, nullptr, &a);
+                REQUIRE(result == db.get(plain, nullptr, &b));
+                if (result == SUCCESS) {
+                    REQUIRE(std::string(a.payload) == b.payload);
+                }
+            }
+        }
+    }
+
+    // Scans still walk the trie in key order
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    Record ra;
+    Record rb;
+    size_t count = 0;
+    ErrCode result;
+    while ((result = db.getNext(hashed, txn, &ra)) == SUCCESS) {
+        REQUIRE(db.getNext(plain, txn, &rb) == SUCCESS);
+        REQUIRE(std::string(ra.key.keyval.charkey) == rb.key.keyval.charkey);
+        count++;
+    }
+    REQUIRE(db.getNext(plain, txn, &rb) == result);
+    REQUIRE(count > 1000);
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+
+    REQUIRE(db.truncateIndex(hashed) == SUCCESS);
+    REQUIRE(db.get(hashed, nullptr, &ra) == KEY_NOTFOUND);
+    REQUIRE(db.insertRecord(hashed, nullptr, &ra.key, "p") == SUCCESS);
+    REQUIRE(db.get(hashed, nullptr, &ra) == SUCCESS);
+
+    REQUIRE(db.closeIndex(hashed) == SUCCESS);
+    REQUIRE(db.closeIndex(plain) == SUCCESS);
+}
+
+TEST_CASE( "Key filter for missing keys", "[keyFilter]" ) {
+    MemDB db;
+    IndexOptions options {};
+    options.keyFilter = 1;
+    options.hashIndex = GENERATE(0, 1);
+    REQUIRE(db.createWithOptions(INT, (char*) "filtered", options) == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("filtered", &state) == SUCCESS);
+
+    // Grows the filter a few times, then deletes half of the keys again
+    Record record;
+    record.key.type = INT;
+    for (int64_t k = 0; k < 20000; k++) {
+        record.key.keyval.intkey = k * 2;
+        REQUIRE(db.insertRecord(state, nullptr, &record.key, "p") == SUCCESS);
+    }
+    for (int64_t k = 0; k < 20000; k += 2) {
+        record.key.keyval.intkey = k * 2;
+        record.payload[0] = 0;
+        REQUIRE(db.deleteRecord(state, nullptr, &record) == SUCCESS);
+    }
+
+    // No false negatives, and most of the missing keys never reach the trie
+    for (int64_t k = 0; k < 40000; k++) {
+        record.key.keyval.intkey = k;
+        bool present = k % 4 == 2;
+        REQUIRE(db.get(state, nullptr, &record) == (present ? SUCCESS : KEY_NOTFOUND));
+    }
+    REQUIRE(state->tree->statistics().keyFilterRejections > 29000);
+
+    KeyRange range {};
+    range.low.type = INT;
+    range.high.type = INT;
+    range.low.keyval.intkey = 0;
+    range.high.keyval.intkey = 10000;
+    range.lowType = INCLUSIVE;
+    range.highType = INCLUSIVE;
+    REQUIRE(db.deleteRange(state, &range, nullptr) == SUCCESS);
+    record.key.keyval.intkey = 10002;
+    REQUIRE(db.get(state, nullptr, &record) == SUCCESS);
+    record.key.keyval.intkey = 9998;
+    REQUIRE(db.get(state, nullptr, &record) == KEY_NOTFOUND);
+
+    REQUIRE(db.truncateIndex(state) == SUCCESS);
+    REQUIRE(db.get(state, nullptr, &record) == KEY_NOTFOUND);
+    REQUIRE(db.insertRecord(state, nullptr, &record.key, "p") == SUCCESS);
+    REQUIRE(db.get(state, nullptr, &record) == SUCCESS);
+
+    // A bulk load into the truncated index sizes the filter for all of its keys
+    REQUIRE(db.truncateIndex(state) == SUCCESS);
+    std::vector<Record> records(5000);
+    for (size_t i = 0; i < records.size(); i++) {
+        records[i].key.type = INT;
+        records[i].key.keyval.intkey = i * 3;
+        strcpy(records[i].payload, "p");
+    }
+    REQUIRE(db.bulkLoad(state, records.data(), records.size(), 2) == SUCCESS);
+    for (int64_t k = 0; k < 15000; k++) {
+        record.key.keyval.intkey = k;
+        REQUIRE(db.get(state, nullptr, &record) == (k % 3 == 0 ? SUCCESS : KEY_NOTFOUND));
+    }
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Finger search of nearly sorted lookups", "[finger]" ) {
+    uint8_t a[12] = {0x12, 0x34, 0x56, 0x78, 0x9a, 0xbc, 0xde, 0xf0, 0x11, 0x22, 0x33, 0x44};
+    uint8_t b[12];
+    memcpy(b, a, sizeof(a));
+    REQUIRE(commonPrefixNibbles(a, b, sizeof(a)) == 24);
+    b[10] = 0x3f;
+    REQUIRE(commonPrefixNibbles(a, b, sizeof(a)) == 21);
+    b[5] = 0x0c;
+    REQUIRE(commonPrefixNibbles(a, b, sizeof(a)) == 10);
+    b[0] = 0x13;
+    REQUIRE(commonPrefixNibbles(a, b, 8) == 1);
+
+    MemDB db;
+    auto type = GENERATE(INT, VARCHAR);
+    REQUIRE(db.create(type, (char*) "idx") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("idx", &state) == SUCCESS);
+
+    Record record;
+    record.key.type = type;
+    auto setKey = [&](int64_t k) {
+        if (type == INT) {
+            record.key.keyval.intkey = k;
+        }
+        else {
+            strcpy(record.key.keyval.charkey, ("key/" + std::to_string(k)).c_str());
+        }
+    };
+
+    std::set<int64_t> keys;
+    std::mt19937 rng(49);
+    for (int i = 0; i < 5000; i++) {
+        int64_t k = rng() % 20000;
+        keys.insert(k);
+        setKey(k);
+        db.insertRecord(state, nullptr, &record.key, "p");
+    }
+
+    // Mostly ascending lookups, with some jumps back and inserts and deletes changing the tree in between
+    int64_t k = 0;
+    for (int i = 0; i < 30000; i++) {
+        k = rng() % 50 ? k + rng() % 3 : rng() % 20000;
+        setKey(k);
+        REQUIRE(db.get(state, nullptr, &record) == (keys.count(k) ? SUCCESS : KEY_NOTFOUND));
+
+        if (rng() % 100 == 0) {
+            int64_t changed = k + rng() % 10;
+            setKey(changed);
+            if (keys.count(changed)) {
+                record.payload[0] = 0;
+                REQUIRE(db.deleteRecord(state, nullptr, &record) == SUCCESS);
+                keys.erase(changed);
+            }
+            else {
+                REQUIRE(db.insertRecord(state, nullptr, &record.key, "p") == SUCCESS);
+                keys.insert(changed);
+            }
+        }
+        k %= 20000;
+    }
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Appends of increasing keys", "[append]" ) {
+    MemDB db;
+    IndexOptions options {};
+    options.subtreeCounts = GENERATE(0, 1);
+    REQUIRE(db.createWithOptions(INT, (char*) "idx", options) == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("idx", &state) == SUCCESS);
+
+    // Mostly ascending keys with gaps of varying width, smaller keys and deletes of the largest one in between
+    std::set<int64_t> keys;
+    std::mt19937 rng(50);
+    Record record;
+    record.key.type = INT;
+    int64_t next = 0;
+    for (int i = 0; i < 40000; i++) {
+        int64_t k = next;
+        if (rng() % 20 == 0) {
+            k = rng() % 200000;
+        }
+        else {
+            next += rng() % 8 == 0 ? rng() % 70000 + 1 : rng() % 3 + 1;
+        }
+        record.key.keyval.intkey = k;
+        REQUIRE(db.insertRecord(state, nullptr, &record.key, "p") == (keys.insert(k).second ? SUCCESS : ENTRY_EXISTS));
+
+        if (rng() % 50 == 0) {
+            record.key.keyval.intkey = *keys.rbegin();
+            record.payload[0] = 0;
+            REQUIRE(db.deleteRecord(state, nullptr, &record) == SUCCESS);
+            keys.erase(std::prev(keys.end()));
+        }
+    }
+
+    std::vector<int64_t> scanned;
+    TxnState* txn = nullptr;
+    REQUIRE(db.beginTransaction(&txn) == SUCCESS);
+    while (db.getNext(state, txn, &record) == SUCCESS) {
+        scanned.push_back(record.key.keyval.intkey);
+    }
+    REQUIRE(db.commitTransaction(txn) == SUCCESS);
+    REQUIRE(scanned == std::vector<int64_t>(keys.begin(), keys.end()));
+
+    if (options.subtreeCounts) {
+        std::vector<int64_t> sorted(keys.begin(), keys.end());
+        for (int64_t probe = 0; probe < next; probe += next / 97 + 1) {
+            size_t rank = 0;
+            record.key.keyval.intkey = probe;
+            REQUIRE(db.rankOfKey(state, &record.key, &rank) == SUCCESS);
+            REQUIRE(rank == (size_t) (std::lower_bound(sorted.begin(), sorted.end(), probe) - sorted.begin()));
+        }
+    }
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}
+
+TEST_CASE( "Abort of a large transaction next to another one", "[transaction]" ) {
+    MemDB db;
+    REQUIRE(db.create(INT, (char*) "hello") == SUCCESS);
+    IdxState* state = nullptr;
+    REQUIRE(db.openIndex("hello", &state) == SUCCESS);
+
+    // Both transactions log entries on the same keys, the aborted one releases the keys only it inserted
+    TxnState* aborted = nullptr;
+    TxnState* committed = nullptr;
+    REQUIRE(db.beginTransaction(&aborted) == SUCCESS);
+    REQUIRE(db.beginTransaction(&committed) == SUCCESS);
+    Key key;
+    key.type = INT;
+    for (int64_t i = 0; i < 20000; i++) {
+        key.keyval.intkey = i;
+        REQUIRE(db.insertRecord(state, aborted, &key, "a") == SUCCESS);
+        if (i % 4 == 0) {
+            REQUIRE(db.insertRecord(state, committed, &key, "b") == SUCCESS);
+        }
+        if (i % 8 == 0) {
+            REQUIRE(db.updateRecord(state, aborted, &key, "a", "c") == SUCCESS);
+        }
+    }
+    REQUIRE(db.abortTransaction(aborted) == SUCCESS);
+    REQUIRE(db.commitTransaction(committed) == SUCCESS);
+
+    Record record;
+    record.key.type = INT;
+    for (int64_t i = 0; i < 20000; i++) {
+        record.key.keyval.intkey = i;
+        if (i % 4 == 0) {
+            REQUIRE(db.get(state, nullptr, &record) == SUCCESS);
+            REQUIRE(std::string(record.payload) == "b");
+        }
+        else {
+            REQUIRE(db.get(state, nullptr, &record) == KEY_NOTFOUND);
+        }
+    }
+
+    REQUIRE(db.closeIndex(state) == SUCCESS);
+}